@@ -0,0 +1,221 @@
+#include "bench.h"
+#include "database.h"
+#include "result_set.h"
+#include "statement_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// The same chunks that the query worker fetches in.
+static const int fetch_rows_per_chunk = 10000;
+static const double fetch_seconds_per_chunk = 0.050;
+
+static const int default_iterations = 10;
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The largest resident set size of the process so far, in bytes,
+// or 0 if we don't know how to find out.
+static long long PeakResidentBytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if __APPLE__
+        return usage.ru_maxrss;
+#else
+        return usage.ru_maxrss * 1024LL;
+#endif
+    }
+#endif
+    return 0;
+}
+
+static bool EndsWith(const std::string& s, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+static bool ReadFile(const char *path, std::string *contents)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        contents->append(buf, n);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static std::string JsonString(const std::string& s)
+{
+    std::string json = "\"";
+    for (size_t i=0; i<s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        }else if (c == '\n') {
+            json += "\\n";
+        }else if (c == '\t') {
+            json += "\\t";
+        }else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            json += buf;
+        }else{
+            json += c;
+        }
+    }
+    return json + "\"";
+}
+
+// The value below which the given fraction of the (sorted) samples fall.
+static double Percentile(const std::vector<double>& sorted, double fraction)
+{
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Run the whole script once, like the query worker does. Returns false on error.
+static bool RunOnce(StatementCache *statements, const std::string& sql, long long *rows, std::string *error)
+{
+    const char *tail = sql.c_str();
+    while (*tail) {
+        ResultSet result;
+        ResultSet dest;
+        bool ok = result.Prepare(statements, tail, &tail);
+        if (ok && result.IsDone()) {
+            continue;
+        }
+        for (;;) {
+            result.MoveRowsTo(&dest);
+            if (!ok || result.IsDone()) break;
+            result.Fetch(fetch_rows_per_chunk, fetch_seconds_per_chunk);
+        }
+        *rows += dest.Rows();
+        if (!ok || dest.HasError()) {
+            *error = dest.HasError() ? dest.Error() : result.Error();
+            return false;
+        }
+    }
+    return true;
+}
+
+int RunBenchmark(int argc, char **argv)
+{
+    // the same options as the GUI, anywhere, but a missing file is an error
+    OpenOptions options;
+    options.create = false;
+    std::vector<const char *> args;
+    std::string option_error;
+    for (int i=0; i<argc && option_error.empty(); i++) {
+        if (!ParseOpenOption(argc, argv, &i, &options, &option_error)) {
+            args.push_back(argv[i]);
+        }
+    }
+
+    int iterations = default_iterations;
+    if (args.size() == 3) {
+        char *end;
+        long count = strtol(args[2], &end, 10);
+        iterations = *end || end == args[2] || count < 1 || count > 1000000000 ? 0 : (int)count;
+    }
+    if (args.size() < 2 || args.size() > 3 || iterations < 1 || !option_error.empty()) {
+        fprintf(stderr, "Usage: sql-gui --bench [--readonly] [--immutable] [--mmap-size size] database (sql | file.sql) [iterations]\n");
+        if (!option_error.empty()) {
+            fprintf(stderr, "%s\n", option_error.c_str());
+        }else if (iterations < 1) {
+            fprintf(stderr, "iterations must be a whole number, 1 or more\n");
+        }
+        return 2;
+    }
+    const char *db_path = args[0];
+    std::string sql = args[1];
+
+    if (EndsWith(sql, ".sql")) {
+        std::string script;
+        if (!ReadFile(sql.c_str(), &script)) {
+            fprintf(stderr, "Failed to read %s\n", sql.c_str());
+            return 1;
+        }
+        sql.swap(script);
+    }
+
+    std::string open_error;
+    sqlite3 *db = OpenDatabase(db_path, options, &open_error);
+    if (!db) {
+        fprintf(stderr, "Failed to open database %s: %s\n", db_path, open_error.c_str());
+        return 1;
+    }
+
+    std::vector<double> latencies;
+    long long rows_per_run = 0;
+    long long total_rows = 0;
+    std::string error;
+    {
+        StatementCache statements(db, 64);
+        for (int i=0; i<iterations; i++) {
+            long long rows = 0;
+            double start = Now();
+            bool ok = RunOnce(&statements, sql, &rows, &error);
+            latencies.push_back(Now() - start);
+            rows_per_run = rows;
+            total_rows += rows;
+            if (!ok) break;
+        }
+    }
+    sqlite3_close(db);
+
+    double total_seconds = 0;
+    for (size_t i=0; i<latencies.size(); i++) {
+        total_seconds += latencies[i];
+    }
+    double first = latencies[0];
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("{\n");
+    printf("  \"database\": %s,\n", JsonString(db_path).c_str());
+    printf("  \"sql\": %s,\n", JsonString(sql).c_str());
+    printf("  \"iterations\": %d,\n", (int)latencies.size());
+    if (!error.empty()) {
+        printf("  \"error\": %s,\n", JsonString(error).c_str());
+    }
+    printf("  \"rows_per_iteration\": %lld,\n", rows_per_run);
+    printf("  \"latency_ms\": {\n");
+    printf("    \"first\": %.3f,\n", first * 1000);
+    printf("    \"min\": %.3f,\n", sorted.front() * 1000);
+    printf("    \"mean\": %.3f,\n", total_seconds / latencies.size() * 1000);
+    printf("    \"p50\": %.3f,\n", Percentile(sorted, 0.50) * 1000);
+    printf("    \"p90\": %.3f,\n", Percentile(sorted, 0.90) * 1000);
+    printf("    \"p99\": %.3f,\n", Percentile(sorted, 0.99) * 1000);
+    printf("    \"max\": %.3f\n", sorted.back() * 1000);
+    printf("  },\n");
+    printf("  \"rows_per_second\": %.1f,\n", total_seconds > 0 ? total_rows / total_seconds : 0.0);
+    printf("  \"peak_memory_bytes\": {\n");
+    printf("    \"sqlite\": %lld,\n", (long long)sqlite3_memory_highwater(0));
+    printf("    \"resident\": %lld\n", PeakResidentBytes());
+    printf("  }\n");
+    printf("}\n");
+
+    return error.empty() ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+// Benchmark - runs a query over and over without any UI, and reports timings.
+//
+//     sql-gui --bench [--readonly] [--immutable] [--mmap-size size] database (sql | file.sql) [iterations]
+//
+// Each run goes through the same ResultSet and StatementCache code as the
+// SQL tab, statement by statement, fetching every row in the same chunks as
+// the query worker. The results are printed to stdout as JSON: latency
+// percentiles, rows per second, and peak memory use.
+
+#pragma once
+
+// Returns the process exit code. argv holds the arguments after "--bench".
+int RunBenchmark(int argc, char **argv);
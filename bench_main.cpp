@@ -0,0 +1,11 @@
+// sql-gui-bench - the --bench mode of sql-gui, on its own.
+//
+// Links only the core library, so it builds and runs on machines
+// without SDL, OpenGL or a display.
+
+#include "bench.h"
+
+int main(int argc, char **argv)
+{
+    return RunBenchmark(argc - 1, argv + 1);
+}
@@ -0,0 +1,128 @@
+#include "connection_pool.h"
+#include "statement_cache.h"
+
+#include <stdio.h>
+#include <chrono>
+
+// How long a connection waits for a lock held by another one before giving up.
+static const int busy_timeout_ms = 5000;
+
+// How many prepared statements the writer keeps around for reuse.
+static const int writer_statement_cache_size = 64;
+
+ConnectionPool::ConnectionPool()
+: writer(NULL)
+, wal(false)
+, readers(0)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    Close();
+}
+
+bool ConnectionPool::Open(const char *db_path, const OpenOptions& options)
+{
+    Close();
+    path = db_path;
+    this->options = options;
+    error.clear();
+
+    writer = OpenDatabase(db_path, options, &error);
+    if (!writer) {
+        return false;
+    }
+    sqlite3_busy_timeout(writer, busy_timeout_ms);
+    writer_statements.reset(new StatementCache(writer, writer_statement_cache_size));
+
+    // "wal", "delete", "memory"... as the file is now, we don't change it
+    journal_mode.clear();
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(writer, "pragma journal_mode", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        journal_mode = (const char *)sqlite3_column_text(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    wal = journal_mode == "wal";
+    return true;
+}
+
+void ConnectionPool::Close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (readers != (int)idle.size()) {
+        fprintf(stderr, "ConnectionPool: closing with %d readers still in use\n", readers - (int)idle.size());
+    }
+    for (size_t i=0; i<idle.size(); i++) {
+        sqlite3_close(idle[i]);
+    }
+    idle.clear();
+    readers = 0;
+
+    writer_statements.reset();
+    sqlite3_close(writer);
+    writer = NULL;
+    wal = false;
+    journal_mode.clear();
+}
+
+sqlite3 *ConnectionPool::AcquireReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty()) {
+            sqlite3 *db = idle.back();
+            idle.pop_back();
+            return db;
+        }
+    }
+
+    std::string reader_error;
+    sqlite3 *db = OpenDatabase(path.c_str(), options, &reader_error);
+    if (!db) {
+        fprintf(stderr, "Failed to open reader connection: %s\n", reader_error.c_str());
+        return NULL;
+    }
+    sqlite3_busy_timeout(db, busy_timeout_ms);
+    sqlite3_exec(db, "pragma query_only=1", NULL, NULL, NULL);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    readers++;
+    return db;
+}
+
+void ConnectionPool::ReleaseReader(sqlite3 *db)
+{
+    if (!db) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(db);
+}
+
+sqlite3 *ConnectionPool::LockWriter(double timeout)
+{
+    if (!writer_mutex.try_lock_for(std::chrono::duration<double>(timeout))) {
+        return NULL;
+    }
+    if (!writer) {
+        writer_mutex.unlock();
+    }
+    return writer;
+}
+
+void ConnectionPool::UnlockWriter()
+{
+    writer_mutex.unlock();
+}
+
+int ConnectionPool::Readers() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return readers;
+}
+
+int ConnectionPool::IdleReaders() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)idle.size();
+}
@@ -0,0 +1,77 @@
+// ConnectionPool - all the connections to one database.
+//
+// Reading is done on reader connections, one for each user that is active
+// at the same time: the main thread's browsing tabs, and each query worker.
+// Readers are query_only, so they can never take a write lock. All writing
+// goes through the one writer connection, which users take turns with.
+//
+// In WAL mode readers don't block the writer, or each other, so browsing a
+// table carries on while a long query runs elsewhere. With a rollback
+// journal a reader still holds up a writer's commit, until the busy
+// timeout runs out, so the pool reports which mode the database is in.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "database.h"
+
+class StatementCache;
+
+class ConnectionPool
+{
+public:
+    ConnectionPool();
+    ~ConnectionPool();
+
+    // Open the writer connection. Returns false (see Error()) on failure.
+    bool Open(const char *db_path, const OpenOptions& options);
+
+    // Close every connection. Readers must all have been released.
+    void Close();
+
+    const std::string& Error() const { return error; }
+
+    // A reader connection of its own for the caller, or NULL if one could
+    // not be opened. Give it back with ReleaseReader(), with all of its
+    // statements finalized and any handlers that were set on it removed.
+    sqlite3 *AcquireReader();
+    void ReleaseReader(sqlite3 *db);
+
+    // Take the writer connection, waiting up to timeout seconds for whoever
+    // has it now. Returns NULL if it is still busy.
+    sqlite3 *LockWriter(double timeout);
+    void UnlockWriter();
+
+    // The writer's prepared statements; only while it is locked.
+    StatementCache *WriterStatements() { return writer_statements.get(); }
+
+    bool IsOpen() const { return writer != NULL; }
+    bool IsWal() const { return wal; }
+    const std::string& JournalMode() const { return journal_mode; }
+    int Readers() const;
+    int IdleReaders() const;
+
+private:
+    ConnectionPool(const ConnectionPool&);
+    ConnectionPool& operator=(const ConnectionPool&);
+
+    std::string path;
+    OpenOptions options;
+    std::string error;
+
+    sqlite3 *writer;
+    std::unique_ptr<StatementCache> writer_statements;
+    std::timed_mutex writer_mutex;
+
+    std::string journal_mode;
+    bool wal;
+
+    mutable std::mutex mutex;
+    std::vector<sqlite3 *> idle;  // guarded by mutex
+    int readers;                  // guarded by mutex
+};
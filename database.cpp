@@ -0,0 +1,140 @@
+#include "database.h"
+#include "statement_cache.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A file: URI for the path, so that query parameters can be added.
+static std::string FileUri(const char *path)
+{
+    if (strncmp(path, "file:", 5) == 0) {
+        return path;
+    }
+    std::string uri = "file:";
+    if (isalpha((unsigned char)path[0]) && path[1] == ':') {
+        // a Windows drive letter
+        uri += '/';
+    }
+    for (const char *p = path; *p; p++) {
+        switch (*p) {
+        case '%': uri += "%25"; break;
+        case '?': uri += "%3f"; break;
+        case '#': uri += "%23"; break;
+        case '\\': uri += '/'; break;
+        default: uri += *p; break;
+        }
+    }
+    return uri;
+}
+
+std::string QuoteIdentifier(const std::string& name)
+{
+    std::string quoted = "\"";
+    for (char c : name) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    quoted += '"';
+    return quoted;
+}
+
+// A size in bytes, with an optional K, M or G suffix. Returns false for
+// anything else, a negative size, or one too big to hold.
+static bool ParseSize(const char *text, sqlite3_int64 *size)
+{
+    if (!isdigit((unsigned char)text[0])) return false;
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (errno == ERANGE) return false;
+
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || value > (LLONG_MAX >> shift)) return false;
+    *size = value << shift;
+    return true;
+}
+
+bool ParseOpenOption(int argc, char **argv, int *i, OpenOptions *options, std::string *error)
+{
+    const char *arg = argv[*i];
+    if (!strcmp(arg, "--readonly")) {
+        options->readonly = true;
+    }else if (!strcmp(arg, "--immutable")) {
+        options->readonly = true;
+        options->immutable = true;
+    }else if (!strcmp(arg, "--mmap-size")) {
+        if (*i+1 >= argc) {
+            *error = "--mmap-size needs a size";
+        }else if (!ParseSize(argv[++*i], &options->mmap_size)) {
+            *error = std::string("--mmap-size must be a number of bytes, with an optional K, M or G, not ") + argv[*i];
+        }
+    }else{
+        return false;
+    }
+    return true;
+}
+
+sqlite3 *OpenDatabase(const char *db_path, const OpenOptions& options, std::string *error)
+{
+    std::string uri;
+    int flags = SQLITE_OPEN_URI;
+    if (!strlen(db_path) || !strcmp(db_path, ":memory:")) {
+        // the memdb VFS shares a database between connections
+        // when its name starts with a '/'
+        uri = "file:/sql-gui-memory?vfs=memdb";
+        flags |= SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    }else if (options.readonly) {
+        uri = FileUri(db_path);
+        if (options.immutable) {
+            uri += uri.find('?') == std::string::npos ? "?immutable=1" : "&immutable=1";
+        }
+        flags |= SQLITE_OPEN_READONLY;
+    }else{
+        uri = FileUri(db_path);
+        flags |= SQLITE_OPEN_READWRITE;
+        if (options.create) flags |= SQLITE_OPEN_CREATE;
+    }
+
+    sqlite3 *db = NULL;
+    int rc = sqlite3_open_v2(uri.c_str(), &db, flags, NULL);
+    if (rc != SQLITE_OK) {
+        *error = db ? sqlite3_errmsg(db) : sqlite3_errstr(rc);
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    if (options.mmap_size >= 0) {
+        char pragma[64];
+        sqlite3_snprintf(sizeof(pragma), pragma, "pragma mmap_size=%lld", options.mmap_size);
+        sqlite3_exec(db, pragma, NULL, NULL, NULL);
+    }
+    return db;
+}
+
+int PragmaInt(StatementCache *statements, const char *pragma)
+{
+    int value = -1;
+    sqlite3_stmt *stmt = statements->Acquire(pragma);
+    if (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int(stmt, 0);
+    }
+    statements->Release(stmt);
+    return value;
+}
+
+DatabaseVersion GetDatabaseVersion(StatementCache *statements)
+{
+    DatabaseVersion version;
+    version.data_version = PragmaInt(statements, "pragma data_version");
+    version.schema_version = PragmaInt(statements, "pragma schema_version");
+    version.total_changes = sqlite3_total_changes(statements->Database());
+    return version;
+}
@@ -0,0 +1,60 @@
+// Database - opening the database, and noticing when it has changed.
+//
+// The Tables and Records tabs re-run their queries every frame as far as
+// the UI is concerned; DatabaseVersion makes sure SQLite only does the work
+// when the query or the database actually changed.
+
+#pragma once
+
+#include <string>
+#include <sqlite3.h>
+
+#include "result_set.h"
+
+class StatementCache;
+
+// How to open the database. For the in-memory database these are ignored,
+// there is nothing there to protect.
+struct OpenOptions
+{
+    bool readonly = false;          // SQLITE_OPEN_READONLY: no writes, so no write locks
+    bool immutable = false;         // immutable=1: the file never changes, so no locks at all
+    sqlite3_int64 mmap_size = -1;   // bytes to memory map, or -1 for SQLite's default
+    bool create = true;             // create the file if it isn't there
+};
+
+// If argv[*i] is one of the options --readonly, --immutable or --mmap-size
+// (with a size in bytes, and an optional K, M or G suffix), apply it to
+// options, step *i past any value it took, and return true. If its value
+// is missing or isn't a size, *error says so, and options is unchanged.
+bool ParseOpenOption(int argc, char **argv, int *i, OpenOptions *options, std::string *error);
+
+// A table or column name, quoted for SQL: "name", with any quotes in it doubled.
+std::string QuoteIdentifier(const std::string& name);
+
+// Open a connection to the database, as the options say. Without a
+// database file we use an in-memory database, shared between connections.
+// Returns NULL, with the reason in *error, if it could not be opened.
+sqlite3 *OpenDatabase(const char *db_path, const OpenOptions& options, std::string *error);
+
+// Everything that tells us whether the database may have changed since we last looked.
+// data_version catches commits made by other connections, total_changes catches
+// our own writes, and schema_version catches DDL (e.g. create/drop table).
+struct DatabaseVersion
+{
+    int data_version = -1;
+    int schema_version = -1;
+    int total_changes = -1;
+
+    bool operator==(const DatabaseVersion& other) const
+    {
+        return data_version == other.data_version
+            && schema_version == other.schema_version
+            && total_changes == other.total_changes;
+    }
+    bool operator!=(const DatabaseVersion& other) const { return !(*this == other); }
+};
+
+int PragmaInt(StatementCache *statements, const char *pragma);
+
+DatabaseVersion GetDatabaseVersion(StatementCache *statements);
@@ -0,0 +1,451 @@
+#include "exporter.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "connection_pool.h"
+
+// How much output is gathered before it is written to the file. Writing
+// in large pieces, unbuffered by stdio, keeps the system calls few and the
+// copies to one.
+static const size_t write_buffer_size = 4 << 20;
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *ExportFormatName(ExportFormat format)
+{
+    switch (format) {
+    case ExportFormat_CSV: return "CSV";
+    case ExportFormat_TSV: return "TSV";
+    case ExportFormat_JSON: return "JSON";
+    case ExportFormat_SQL: return "SQL";
+    default: return "";
+    }
+}
+
+const char *ExportFormatExtension(ExportFormat format)
+{
+    switch (format) {
+    case ExportFormat_CSV: return ".csv";
+    case ExportFormat_TSV: return ".tsv";
+    case ExportFormat_JSON: return ".json";
+    case ExportFormat_SQL: return ".sql";
+    default: return "";
+    }
+}
+
+static void AppendHex(std::string *out, const unsigned char *data, int len)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < len; i++) {
+        out->push_back(digits[data[i] >> 4]);
+        out->push_back(digits[data[i] & 15]);
+    }
+}
+
+// The shortest of 15 or 17 significant digits that reads back as the same
+// double, the way the sqlite3 shell's .dump does it.
+static void AppendReal(std::string *out, double value)
+{
+    char text[64];
+    sqlite3_snprintf(sizeof(text), text, "%!.15g", value);
+    if (strtod(text, NULL) != value) {
+        sqlite3_snprintf(sizeof(text), text, "%!.17g", value);
+    }
+    out->append(text);
+}
+
+static void AppendCsv(std::string *out, const char *text, int len)
+{
+    bool quote = len == 0;  // so that '' and NULL can be told apart
+    for (int i = 0; i < len && !quote; i++) {
+        char c = text[i];
+        quote = c == ',' || c == '"' || c == '\r' || c == '\n';
+    }
+    if (!quote) {
+        out->append(text, len);
+        return;
+    }
+    out->push_back('"');
+    for (int i = 0; i < len; i++) {
+        if (text[i] == '"') out->push_back('"');
+        out->push_back(text[i]);
+    }
+    out->push_back('"');
+}
+
+static void AppendTsv(std::string *out, const char *text, int len)
+{
+    for (int i = 0; i < len; i++) {
+        switch (text[i]) {
+        case '\t': out->append("\\t"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\\': out->append("\\\\"); break;
+        default: out->push_back(text[i]); break;
+        }
+    }
+}
+
+static void AppendJsonString(std::string *out, const char *text, int len)
+{
+    out->push_back('"');
+    for (int i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        switch (c) {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out->append(escape);
+            }else{
+                out->push_back(c);
+            }
+            break;
+        }
+    }
+    out->push_back('"');
+}
+
+static void AppendSqlString(std::string *out, const char *text, int len)
+{
+    out->push_back('\'');
+    for (int i = 0; i < len; i++) {
+        if (text[i] == '\'') out->push_back('\'');
+        out->push_back(text[i]);
+    }
+    out->push_back('\'');
+}
+
+static void AppendSqlName(std::string *out, const char *name)
+{
+    out->push_back('"');
+    for (const char *c = name; *c; c++) {
+        if (*c == '"') out->push_back('"');
+        out->push_back(*c);
+    }
+    out->push_back('"');
+}
+
+// One value of the current row, in the given format.
+static void AppendValue(std::string *out, sqlite3_stmt *stmt, int col, ExportFormat format)
+{
+    int type = sqlite3_column_type(stmt, col);
+
+    if (type == SQLITE_NULL) {
+        switch (format) {
+        case ExportFormat_TSV: out->append("\\N"); break;
+        case ExportFormat_JSON: out->append("null"); break;
+        case ExportFormat_SQL: out->append("NULL"); break;
+        default: break;
+        }
+        return;
+    }
+
+    if (type == SQLITE_INTEGER) {
+        char text[32];
+        snprintf(text, sizeof(text), "%lld", (long long)sqlite3_column_int64(stmt, col));
+        out->append(text);
+        return;
+    }
+
+    if (type == SQLITE_FLOAT) {
+        double value = sqlite3_column_double(stmt, col);
+        if (isfinite(value)) {
+            AppendReal(out, value);
+        }else if (format == ExportFormat_JSON) {
+            out->append("null");
+        }else if (format == ExportFormat_SQL) {
+            out->append(value < 0 ? "-1e999" : "1e999");
+        }else{
+            out->append(value < 0 ? "-Inf" : "Inf");
+        }
+        return;
+    }
+
+    if (type == SQLITE_BLOB && (format == ExportFormat_JSON || format == ExportFormat_SQL)) {
+        const unsigned char *data = (const unsigned char *)sqlite3_column_blob(stmt, col);
+        int len = sqlite3_column_bytes(stmt, col);
+        out->append(format == ExportFormat_SQL ? "X'" : "\"");
+        AppendHex(out, data, len);
+        out->push_back(format == ExportFormat_SQL ? '\'' : '"');
+        return;
+    }
+
+    // text, and blobs in the formats that are text only
+    const char *text = (const char *)sqlite3_column_text(stmt, col);
+    int len = sqlite3_column_bytes(stmt, col);
+    switch (format) {
+    case ExportFormat_CSV: AppendCsv(out, text, len); break;
+    case ExportFormat_TSV: AppendTsv(out, text, len); break;
+    case ExportFormat_JSON: AppendJsonString(out, text, len); break;
+    case ExportFormat_SQL: AppendSqlString(out, text, len); break;
+    default: break;
+    }
+}
+
+Exporter::Exporter()
+: pool(NULL)
+, db(NULL)
+, busy(false)
+, stepping(false)
+, start_time(0)
+, end_time(0)
+, cancelled(false)
+, rows(0)
+, bytes(0)
+{
+}
+
+Exporter::~Exporter()
+{
+    Stop();
+}
+
+bool Exporter::Start(ConnectionPool *pool, const std::string& sql, const std::string& path, ExportFormat format,
+    const std::string& table)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy) {
+        error = "An export is already running.";
+        return false;
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    sqlite3 *reader = pool ? pool->AcquireReader() : NULL;
+    if (!reader) {
+        error = "No database is open.";
+        return false;
+    }
+
+    this->pool = pool;
+    this->db = reader;
+    this->path = path;
+    cancelled = false;
+    rows = 0;
+    bytes = 0;
+    busy = true;
+    error.clear();
+    start_time = Now();
+    end_time = start_time;
+    thread = std::thread(&Exporter::Run, this, sql, format, table);
+    return true;
+}
+
+void Exporter::Cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!busy) return;
+    cancelled = true;
+    // only while a statement runs: an interrupt with none running would
+    // stay pending, and stop whoever uses the reader next
+    if (db && stepping) sqlite3_interrupt(db);
+}
+
+void Exporter::Stop()
+{
+    Cancel();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool Exporter::IsBusy() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return busy;
+}
+
+double Exporter::ElapsedSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (busy ? Now() : end_time) - start_time;
+}
+
+std::string Exporter::Error() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+bool Exporter::Flush(FILE *file, std::string *buffer)
+{
+    if (buffer->empty()) return true;
+    size_t size = buffer->size();
+    size_t written = fwrite(buffer->data(), 1, size, file);
+    buffer->clear();
+    return written == size;
+}
+
+void Exporter::Run(std::string sql, ExportFormat format, std::string table)
+{
+    std::string failure;
+    bool stopped = false;
+    sqlite3_stmt *stmt = NULL;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        failure = path + ": " + strerror(errno);
+    }else{
+        // we do our own buffering
+        setvbuf(file, NULL, _IONBF, 0);
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+            failure = sqlite3_errmsg(db);
+        }else if (!stmt || sqlite3_column_count(stmt) == 0) {
+            failure = "The statement returns no rows to export.";
+        }else if (!sqlite3_stmt_readonly(stmt)) {
+            failure = "Only a statement that reads can be exported.";
+        }
+    }
+
+    if (failure.empty()) {
+        int columns = sqlite3_column_count(stmt);
+        std::string buffer;
+        buffer.reserve(write_buffer_size + 64 * 1024);
+
+        // What goes before each value, worked out once: the JSON keys, and
+        // the start of each insert statement.
+        std::vector<std::string> keys(columns);
+        std::string insert;
+        switch (format) {
+        case ExportFormat_CSV:
+        case ExportFormat_TSV:
+            for (int col = 0; col < columns; col++) {
+                const char *name = sqlite3_column_name(stmt, col);
+                if (col) buffer.push_back(format == ExportFormat_CSV ? ',' : '\t');
+                if (format == ExportFormat_CSV) {
+                    AppendCsv(&buffer, name, (int)strlen(name));
+                }else{
+                    AppendTsv(&buffer, name, (int)strlen(name));
+                }
+            }
+            buffer.append(format == ExportFormat_CSV ? "\r\n" : "\n");
+            break;
+        case ExportFormat_JSON:
+            for (int col = 0; col < columns; col++) {
+                const char *name = sqlite3_column_name(stmt, col);
+                keys[col] = col ? "," : "{";
+                AppendJsonString(&keys[col], name, (int)strlen(name));
+                keys[col].push_back(':');
+            }
+            buffer.append("[\n");
+            break;
+        case ExportFormat_SQL:
+            insert = "INSERT INTO ";
+            AppendSqlName(&insert, table.empty() ? "exported" : table.c_str());
+            insert.push_back('(');
+            for (int col = 0; col < columns; col++) {
+                if (col) insert.push_back(',');
+                AppendSqlName(&insert, sqlite3_column_name(stmt, col));
+            }
+            insert.append(") VALUES(");
+            buffer.append("BEGIN TRANSACTION;\n");
+            break;
+        default:
+            break;
+        }
+
+        long long written = 0;
+        long long count = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stepping = true;
+        }
+        int rc;
+        while ((rc = cancelled ? SQLITE_INTERRUPT : sqlite3_step(stmt)) == SQLITE_ROW) {
+            switch (format) {
+            case ExportFormat_CSV:
+            case ExportFormat_TSV:
+                for (int col = 0; col < columns; col++) {
+                    if (col) buffer.push_back(format == ExportFormat_CSV ? ',' : '\t');
+                    AppendValue(&buffer, stmt, col, format);
+                }
+                buffer.append(format == ExportFormat_CSV ? "\r\n" : "\n");
+                break;
+            case ExportFormat_JSON:
+                if (count) buffer.append(",\n");
+                for (int col = 0; col < columns; col++) {
+                    buffer.append(keys[col]);
+                    AppendValue(&buffer, stmt, col, format);
+                }
+                buffer.push_back('}');
+                break;
+            case ExportFormat_SQL:
+                buffer.append(insert);
+                for (int col = 0; col < columns; col++) {
+                    if (col) buffer.push_back(',');
+                    AppendValue(&buffer, stmt, col, format);
+                }
+                buffer.append(");\n");
+                break;
+            default:
+                break;
+            }
+            count++;
+
+            if (buffer.size() >= write_buffer_size) {
+                written += buffer.size();
+                if (!Flush(file, &buffer)) {
+                    failure = path + ": " + strerror(errno);
+                    break;
+                }
+            }
+            rows.store(count, std::memory_order_relaxed);
+            bytes.store(written + buffer.size(), std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stepping = false;
+        }
+
+        // a cancel that comes after the last row is too late to count
+        stopped = rc == SQLITE_INTERRUPT && cancelled;
+        if (failure.empty() && rc != SQLITE_DONE) {
+            failure = stopped ? "Cancelled." : sqlite3_errmsg(db);
+        }
+        if (failure.empty()) {
+            switch (format) {
+            case ExportFormat_JSON: buffer.append(count ? "\n]\n" : "]\n"); break;
+            case ExportFormat_SQL: buffer.append("COMMIT;\n"); break;
+            default: break;
+            }
+            written += buffer.size();
+            if (!Flush(file, &buffer)) {
+                failure = path + ": " + strerror(errno);
+            }
+            bytes = written;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    if (file && fclose(file) != 0 && failure.empty()) {
+        failure = path + ": " + strerror(errno);
+    }
+    if (!failure.empty()) {
+        if (file) remove(path.c_str());
+        if (!stopped) fprintf(stderr, "Export error: %s\n", failure.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pool->ReleaseReader(db);
+    db = NULL;
+    cancelled = stopped;
+    error = failure;
+    end_time = Now();
+    busy = false;
+}
@@ -0,0 +1,86 @@
+// Exporter - writes the result of a query to a file, on a thread of its own.
+//
+// The query is run again from the start on a reader connection of the
+// exporter's own, and each row goes straight into the output as it comes,
+// so an export takes the same memory however many rows it has. The output
+// is built up in a large buffer and written out a buffer at a time.
+
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sqlite3.h>
+
+class ConnectionPool;
+
+enum ExportFormat
+{
+    ExportFormat_CSV,   // RFC 4180, with a header row
+    ExportFormat_TSV,   // tab separated, with a header row; tabs, newlines and backslashes escaped, NULL as \N
+    ExportFormat_JSON,  // an array of objects, one per line
+    ExportFormat_SQL,   // insert statements, in one transaction
+    ExportFormat_Count
+};
+
+const char *ExportFormatName(ExportFormat format);
+const char *ExportFormatExtension(ExportFormat format);
+
+class Exporter
+{
+public:
+    Exporter();
+    ~Exporter();
+
+    // Start exporting what sql returns to the file at path, replacing it.
+    // For ExportFormat_SQL, table is the table to insert into. Returns false
+    // (see Error()) if an export is already running or there's no connection.
+    // The pool must outlive the export.
+    bool Start(ConnectionPool *pool, const std::string& sql, const std::string& path, ExportFormat format,
+        const std::string& table);
+
+    // Stop the export, if it is still reading rows. The partial file is
+    // removed. Once the last row is in, the export finishes regardless.
+    void Cancel();
+
+    // Cancel, and wait for the thread to be done with its connection.
+    void Stop();
+
+    bool IsBusy() const;
+    double ElapsedSeconds() const;
+
+    // Progress so far, or in the end.
+    long long Rows() const { return rows; }
+    long long Bytes() const { return bytes; }
+
+    // Where the last export went, and why it failed, if it did.
+    const std::string& Path() const { return path; }
+    std::string Error() const;
+    bool WasCancelled() const { return cancelled; }
+
+private:
+    Exporter(const Exporter&);
+    Exporter& operator=(const Exporter&);
+
+    void Run(std::string sql, ExportFormat format, std::string table);
+    bool Flush(FILE *file, std::string *buffer);
+
+    ConnectionPool *pool;
+    sqlite3 *db;
+    std::string path;
+    std::thread thread;
+
+    mutable std::mutex mutex;
+    // guarded by mutex
+    bool busy;
+    bool stepping;  // rows are being read, so Cancel() may interrupt db
+    std::string error;
+    double start_time;
+    double end_time;
+
+    std::atomic<bool> cancelled;
+    std::atomic<long long> rows;
+    std::atomic<long long> bytes;
+};
@@ -0,0 +1,95 @@
+#include "frame_timer.h"
+
+#include <string.h>
+#include <algorithm>
+
+const char *FramePhaseName(int phase)
+{
+    static const char *names[FramePhase_Count] = {
+        "Wait",
+        "Queries",
+        "Tables",
+        "UI",
+        "Render",
+        "Swap",
+    };
+    return phase >= 0 && phase < FramePhase_Count ? names[phase] : "";
+}
+
+float FrameTimer::Frame::BusyMs() const
+{
+    float total = 0;
+    for (int phase=0; phase<FramePhase_Count; phase++) {
+        if (phase != FramePhase_Wait) total += ms[phase];
+    }
+    return total;
+}
+
+FrameTimer::Scope::Scope(FrameTimer *timer, FramePhase phase)
+: timer(timer)
+, phase(phase)
+, start(std::chrono::steady_clock::now())
+{
+    timer->depth++;
+}
+
+FrameTimer::Scope::~Scope()
+{
+    timer->depth--;
+    if (timer->depth == 0) {
+        timer->Add(phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+FrameTimer::FrameTimer()
+: frame_number(0)
+, depth(0)
+, history_offset(0)
+{
+    memset(phase_seconds, 0, sizeof(phase_seconds));
+    memset(history, 0, sizeof(history));
+}
+
+void FrameTimer::Add(FramePhase phase, double seconds)
+{
+    phase_seconds[phase] += seconds;
+}
+
+void FrameTimer::BeginFrame()
+{
+    frame_start = std::chrono::steady_clock::now();
+    memset(phase_seconds, 0, sizeof(phase_seconds));
+}
+
+void FrameTimer::EndFrame()
+{
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+
+    // whatever wasn't timed explicitly went into building the UI
+    double timed = 0;
+    for (int phase=0; phase<FramePhase_Count; phase++) {
+        timed += phase_seconds[phase];
+    }
+    phase_seconds[FramePhase_UI] += std::max(0.0, total - timed);
+
+    Frame frame;
+    frame.number = frame_number++;
+    for (int phase=0; phase<FramePhase_Count; phase++) {
+        frame.ms[phase] = (float)(phase_seconds[phase] * 1000);
+        history[phase][history_offset] = frame.ms[phase];
+    }
+    history_offset = (history_offset + 1) % history_size;
+
+    // keep the worst few, worst first
+    if ((int)worst.size() < worst_count || frame.BusyMs() > worst.back().BusyMs()) {
+        std::vector<Frame>::iterator it = worst.begin();
+        while (it != worst.end() && it->BusyMs() >= frame.BusyMs()) ++it;
+        worst.insert(it, frame);
+        if ((int)worst.size() > worst_count) worst.pop_back();
+    }
+}
+
+void FrameTimer::ResetWorst()
+{
+    worst.clear();
+}
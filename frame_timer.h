@@ -0,0 +1,81 @@
+// FrameTimer - where the time in each frame of the main loop goes.
+//
+// The main loop is split into phases: waiting for input, running queries,
+// drawing result tables, the rest of the UI, and rendering. Scoped timers
+// add up the time spent in each phase, and at the end of the frame the
+// totals go into a rolling history for the frame time overlay. The worst
+// frames seen so far are kept along with their breakdown, so a one-off
+// stutter can still be looked at after it has scrolled out of the graph.
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+enum FramePhase
+{
+    FramePhase_Wait,     // waiting for and handling input events
+    FramePhase_Queries,  // preparing statements and fetching rows
+    FramePhase_Table,    // DisplayTable
+    FramePhase_UI,       // the rest of building the frame
+    FramePhase_Render,   // ImGui::Render and RenderDrawData
+    FramePhase_Swap,     // swapping buffers, which may wait for vsync
+    FramePhase_Count
+};
+
+const char *FramePhaseName(int phase);
+
+class FrameTimer
+{
+public:
+    // How many frames the graphs cover, and how many worst frames are kept.
+    static const int history_size = 240;
+    static const int worst_count = 5;
+
+    struct Frame
+    {
+        int number;
+        float ms[FramePhase_Count];
+
+        // the whole frame, apart from waiting for input
+        float BusyMs() const;
+    };
+
+    // Adds the time until it goes out of scope to one phase of the current frame.
+    class Scope
+    {
+    public:
+        Scope(FrameTimer *timer, FramePhase phase);
+        ~Scope();
+    private:
+        FrameTimer *timer;
+        FramePhase phase;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    FrameTimer();
+
+    void BeginFrame();
+    void EndFrame();
+
+    // Forget the worst frames, to look for new ones.
+    void ResetWorst();
+
+    // The history of one phase, in milliseconds, starting at HistoryOffset().
+    const float *History(int phase) const { return history[phase]; }
+    int HistoryOffset() const { return history_offset; }
+
+    const std::vector<Frame>& Worst() const { return worst; }
+
+private:
+    void Add(FramePhase phase, double seconds);
+
+    int frame_number;
+    std::chrono::steady_clock::time_point frame_start;
+    double phase_seconds[FramePhase_Count];
+    int depth;  // of nested scopes, only the outermost one counts
+
+    float history[FramePhase_Count][history_size];
+    int history_offset;
+    std::vector<Frame> worst;  // worst first
+};
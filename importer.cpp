@@ -0,0 +1,860 @@
+#include "importer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "connection_pool.h"
+#include "string_arena.h"
+
+// The file is cut into pieces of about this size, each parsed on its own.
+static const size_t parse_chunk_size = 4 << 20;
+
+// How many parsed pieces may be waiting to be inserted, per parser thread.
+// This is what bounds the memory an import takes.
+static const int chunks_ahead_per_thread = 2;
+
+// Parsing is only ever a few times faster than inserting, so more threads
+// than this just wait.
+static const int max_parser_threads = 8;
+
+// How many rows go into each transaction.
+static const long long rows_per_transaction = 500000;
+
+// How long to wait for the writer connection at a time, or for the next
+// parsed piece, before checking whether the import has been cancelled.
+static const double wait_seconds = 0.050;
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *ImportFormatName(ImportFormat format)
+{
+    switch (format) {
+    case ImportFormat_CSV: return "CSV";
+    case ImportFormat_TSV: return "TSV";
+    default: return "";
+    }
+}
+
+// A file mapped into memory, read-only.
+class MappedFile
+{
+public:
+    MappedFile()
+    : data(NULL)
+    , size(0)
+    {
+    }
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const char *path, std::string *error)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            *error = std::string(path) + ": cannot open the file";
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file, &file_size)) {
+            size = (size_t)file_size.QuadPart;
+        }
+        if (size) {
+            // the view keeps the mapping alive by itself
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (size && !data) {
+            *error = std::string(path) + ": cannot map the file into memory";
+            size = 0;
+            return false;
+        }
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            *error = std::string(path) + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            size = (size_t)st.st_size;
+        }
+        if (size) {
+            void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                *error = std::string(path) + ": " + strerror(errno);
+                size = 0;
+                close(fd);
+                return false;
+            }
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            data = (const char *)mapped;
+        }
+        close(fd);
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+        if (data) {
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap((void *)data, size);
+#endif
+        }
+        data = NULL;
+        size = 0;
+    }
+
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char *data;
+    size_t size;
+};
+
+// Finds the next of four characters, sixteen bytes at a time where SSE2
+// is available, which is every x86-64 machine. Elsewhere it looks each
+// byte up in a table.
+class Scanner
+{
+public:
+    Scanner(char a, char b, char c, char d)
+    {
+        memset(special, 0, sizeof(special));
+        const char chars[4] = { a, b, c, d };
+        for (int i=0; i<4; i++) {
+            special[(unsigned char)chars[i]] = 1;
+#if defined(__SSE2__)
+            vectors[i] = _mm_set1_epi8(chars[i]);
+#endif
+        }
+    }
+
+    // The first of the characters at or after p, or end.
+    const char *Find(const char *p, const char *end) const
+    {
+#if defined(__SSE2__)
+        while (end - p >= 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, vectors[0]), _mm_cmpeq_epi8(bytes, vectors[1])),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, vectors[2]), _mm_cmpeq_epi8(bytes, vectors[3])));
+            int mask = _mm_movemask_epi8(hits);
+            if (mask) return p + __builtin_ctz(mask);
+            p += 16;
+        }
+#endif
+        while (p < end && !special[(unsigned char)*p]) p++;
+        return p;
+    }
+
+private:
+    unsigned char special[256];
+#if defined(__SSE2__)
+    __m128i vectors[4];
+#endif
+};
+
+// How many times c occurs between p and end.
+static size_t Count(const char *p, const char *end, char c)
+{
+    size_t count = 0;
+#if defined(__SSE2__)
+    __m128i vector = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, vector)));
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == c) count++;
+    }
+    return count;
+}
+
+// One field, ready to bind.
+struct ImportValue
+{
+    int type;    // SQLITE_NULL, SQLITE_INTEGER, SQLITE_FLOAT or SQLITE_TEXT
+    int length;  // SQLITE_TEXT: in bytes
+    union
+    {
+        const char *text;  // in the file, or in the piece's arena
+        sqlite3_int64 integer;
+        double real;
+    };
+};
+
+// An unquoted field: a number if it is written like one, otherwise text.
+// Numbers with leading zeros, like 007, are codes, and stay text.
+static void SetNumberOrText(const char *text, size_t length, ImportValue *value)
+{
+    value->type = SQLITE_TEXT;
+    value->text = text;
+    value->length = (int)length;
+    if (length == 0 || length > 32) return;
+
+    const char *p = text;
+    const char *end = text + length;
+    if (*p == '-') p++;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    size_t digit_count = p - digits;
+    if (digit_count == 0) return;
+    if (digit_count > 1 && *digits == '0') return;
+
+    if (p == end) {
+        // anything longer might not fit
+        if (digit_count > 18) return;
+        sqlite3_int64 integer = 0;
+        for (const char *d = digits; d < end; d++) {
+            integer = integer * 10 + (*d - '0');
+        }
+        value->type = SQLITE_INTEGER;
+        value->integer = *text == '-' ? -integer : integer;
+        return;
+    }
+
+    if (*p == '.') {
+        const char *fraction = ++p;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+        if (p == fraction) return;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        const char *exponent = p;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+        if (p == exponent) return;
+    }
+    if (p != end) return;
+
+    // the field isn't terminated in the file, so strtod gets a copy
+    char copy[40];
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    value->type = SQLITE_FLOAT;
+    value->real = strtod(copy, NULL);
+}
+
+// Splits rows into fields. The same parser is used from several threads,
+// each with its own scratch space.
+class RowParser
+{
+public:
+    RowParser(ImportFormat format)
+    : format(format)
+    , fields(format == ImportFormat_TSV ? Scanner('\t', '\n', '\r', '\\') : Scanner(',', '\n', '\r', '"'))
+    , delimiter(format == ImportFormat_TSV ? '\t' : ',')
+    {
+    }
+
+    // Parse the row at p into values, one per field, with the text of any
+    // field that had to be unescaped kept in arena. Returns where the next
+    // row starts.
+    const char *Parse(const char *p, const char *end, std::vector<ImportValue> *values, StringArena *arena)
+    {
+        values->clear();
+        for (;;) {
+            ImportValue value;
+            if (format == ImportFormat_TSV) {
+                p = ParseTsvField(p, end, arena, &value);
+            }else{
+                p = ParseCsvField(p, end, arena, &value);
+            }
+            values->push_back(value);
+            if (p == end) return p;
+            if (*p == delimiter) {
+                p++;
+                continue;
+            }
+            // the end of the row: \n or \r\n
+            if (*p == '\r') p++;
+            return p < end ? p + 1 : p;
+        }
+    }
+
+private:
+    // Where the unquoted text from p ends. A \r only ends it as part of \r\n.
+    const char *FindEnd(const char *p, const char *end) const
+    {
+        for (;;) {
+            p = fields.Find(p, end);
+            if (p < end && *p == '\r' && p + 1 < end && p[1] != '\n') {
+                p++;
+                continue;
+            }
+            return p;
+        }
+    }
+
+    const char *ParseCsvField(const char *p, const char *end, StringArena *arena, ImportValue *value)
+    {
+        const char *q = FindEnd(p, end);
+        if (q == end || *q != '"') {
+            if (q == p) {
+                value->type = SQLITE_NULL;
+            }else{
+                SetNumberOrText(p, q - p, value);
+            }
+            return q;
+        }
+
+        // Quoted: every quote goes in or out of quotes, and a quote right
+        // after the closing one is a literal quote. Counting quotes is how
+        // the file was cut into pieces, so this has to agree with it even
+        // when the quoting is malformed.
+        const char *field = p;
+        const char *run = p;
+        const char *closed = NULL;
+        bool in_quotes = false;
+        int quotes = 0;
+        scratch.clear();
+        for (q = p; ; ) {
+            q = in_quotes ? fields.Find(q, end) : FindEnd(q, end);
+            if (q == end) break;
+            if (*q != '"') {
+                if (!in_quotes) break;
+                q++;
+                continue;
+            }
+            scratch.append(run, q);
+            if (in_quotes) {
+                closed = q + 1;
+            }else if (q == closed) {
+                scratch.push_back('"');
+            }
+            in_quotes = !in_quotes;
+            quotes++;
+            run = ++q;
+        }
+        scratch.append(run, q);
+
+        value->type = SQLITE_TEXT;
+        value->length = (int)scratch.size();
+        if (quotes == 2 && *field == '"' && closed == q) {
+            // just "text", which can be used where it is
+            value->text = field + 1;
+        }else{
+            value->text = arena->Store(scratch.data(), scratch.size());
+        }
+        return q;
+    }
+
+    const char *ParseTsvField(const char *p, const char *end, StringArena *arena, ImportValue *value)
+    {
+        const char *q = FindEnd(p, end);
+        if (q == end || *q != '\\') {
+            if (q == p) {
+                value->type = SQLITE_TEXT;
+                value->text = p;
+                value->length = 0;
+            }else{
+                SetNumberOrText(p, q - p, value);
+            }
+            return q;
+        }
+        if (q == p && q + 2 <= end && q[1] == 'N' && FindEnd(q + 2, end) == q + 2 && (q + 2 == end || q[2] != '\\')) {
+            value->type = SQLITE_NULL;
+            return q + 2;
+        }
+
+        const char *run = p;
+        scratch.clear();
+        for (;;) {
+            if (q == end || *q != '\\') break;
+            scratch.append(run, q);
+            char c = q + 1 < end ? q[1] : '\\';
+            switch (c) {
+            case 't': scratch.push_back('\t'); break;
+            case 'n': scratch.push_back('\n'); break;
+            case 'r': scratch.push_back('\r'); break;
+            case '\\': scratch.push_back('\\'); break;
+            default: scratch.push_back('\\'); scratch.push_back(c); break;
+            }
+            run = std::min(q + 2, end);
+            q = FindEnd(run, end);
+        }
+        scratch.append(run, q);
+        value->type = SQLITE_TEXT;
+        value->text = arena->Store(scratch.data(), scratch.size());
+        value->length = (int)scratch.size();
+        return q;
+    }
+
+    ImportFormat format;
+    Scanner fields;
+    char delimiter;
+    std::string scratch;
+};
+
+// A piece of the file, parsed, waiting to be inserted.
+struct ParsedChunk
+{
+    std::vector<ImportValue> values;  // one per column, row after row
+    StringArena arena;
+    long long rows = 0;
+    bool ready = false;
+
+    void Parse(RowParser *parser, const char *p, const char *end, int columns)
+    {
+        std::vector<ImportValue> row;
+        while (p < end) {
+            // blank lines are no rows at all
+            if (*p == '\n') {
+                p++;
+                continue;
+            }
+            if (*p == '\r' && p + 1 < end && p[1] == '\n') {
+                p += 2;
+                continue;
+            }
+            p = parser->Parse(p, end, &row, &arena);
+            // short rows are padded with NULLs, and long ones cut short
+            ImportValue null;
+            null.type = SQLITE_NULL;
+            row.resize(columns, null);
+            values.insert(values.end(), row.begin(), row.end());
+            rows++;
+        }
+    }
+
+    void Clear()
+    {
+        values.clear();
+        arena.Clear();
+        rows = 0;
+        ready = false;
+    }
+};
+
+static std::string QuoteName(const std::string& name)
+{
+    std::string quoted = "\"";
+    for (char c : name) {
+        if (c == '"') quoted.push_back('"');
+        quoted.push_back(c);
+    }
+    quoted.push_back('"');
+    return quoted;
+}
+
+static bool Exec(sqlite3 *db, const std::string& sql, std::string *failure)
+{
+    if (sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) != SQLITE_OK) {
+        if (failure->empty()) *failure = sqlite3_errmsg(db);
+        return false;
+    }
+    return true;
+}
+
+Importer::Importer()
+: pool(NULL)
+, busy(false)
+, start_time(0)
+, end_time(0)
+, cancelled(false)
+, rows(0)
+, bytes(0)
+, file_size(0)
+{
+}
+
+Importer::~Importer()
+{
+    Stop();
+}
+
+bool Importer::Start(ConnectionPool *pool, const std::string& path, const std::string& table,
+    const ImportOptions& options)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy) {
+        error = "An import is already running.";
+        return false;
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (!pool || !pool->IsOpen()) {
+        error = "No database is open.";
+        return false;
+    }
+    if (table.empty()) {
+        error = "No table to import into.";
+        return false;
+    }
+
+    this->pool = pool;
+    this->table = table;
+    cancelled = false;
+    rows = 0;
+    bytes = 0;
+    file_size = 0;
+    busy = true;
+    error.clear();
+    start_time = Now();
+    end_time = start_time;
+    thread = std::thread(&Importer::Run, this, path, options);
+    return true;
+}
+
+void Importer::Cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy) cancelled = true;
+}
+
+void Importer::Stop()
+{
+    Cancel();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool Importer::IsBusy() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return busy;
+}
+
+double Importer::ElapsedSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (busy ? Now() : end_time) - start_time;
+}
+
+std::string Importer::Error() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+void Importer::Run(std::string path, ImportOptions options)
+{
+    std::string failure;
+    MappedFile file;
+    if (file.Open(path.c_str(), &failure)) {
+        file_size = file.Size();
+
+        // the writer is ours for the whole import
+        sqlite3 *db = NULL;
+        while (!cancelled && pool->IsOpen() && !(db = pool->LockWriter(wait_seconds))) {
+        }
+        if (db) {
+            Load(file.Data(), file.Size(), db, options, &failure);
+            pool->UnlockWriter();
+        }else if (!cancelled) {
+            failure = "The database is closed.";
+        }
+    }
+    if (!failure.empty() && !cancelled) {
+        fprintf(stderr, "Import error: %s\n", failure.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    error = failure;
+    end_time = Now();
+    busy = false;
+}
+
+bool Importer::Load(const char *data, size_t size, sqlite3 *db, const ImportOptions& options, std::string *failure)
+{
+    const char *end = data + size;
+    RowParser parser(options.format);
+
+    // The first row says how many columns there are, and maybe their names.
+    std::vector<ImportValue> first;
+    StringArena first_arena;
+    const char *body = data;
+    while (body < end && (*body == '\n' || *body == '\r')) body++;
+    if (body == end) {
+        *failure = "The file is empty.";
+        return false;
+    }
+    const char *after_first = parser.Parse(body, end, &first, &first_arena);
+    int columns = (int)first.size();
+    std::vector<std::string> names;
+    if (options.header) {
+        for (int col=0; col<columns; col++) {
+            const ImportValue& value = first[col];
+            std::string name;
+            if (value.type == SQLITE_TEXT) {
+                name.assign(value.text, value.length);
+            }else if (value.type == SQLITE_INTEGER) {
+                name = std::to_string(value.integer);
+            }
+            if (name.empty()) {
+                name = "c" + std::to_string(col + 1);
+            }
+            // the same name twice gets a number
+            std::string unique = name;
+            for (int n=2; ; n++) {
+                bool taken = false;
+                for (const std::string& other : names) {
+                    if (!sqlite3_stricmp(other.c_str(), unique.c_str())) taken = true;
+                }
+                if (!taken) break;
+                unique = name + "_" + std::to_string(n);
+            }
+            names.push_back(unique);
+        }
+        body = after_first;
+    }
+
+    // Make the table, unless it's there already.
+    bool exists = false;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, "select count(*) from pragma_table_info(?1)", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+    }
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    std::string insert = "insert into " + QuoteName(table);
+    if (!exists) {
+        std::string create = "create table " + QuoteName(table) + "(";
+        for (int col=0; col<columns; col++) {
+            if (col) create += ", ";
+            create += QuoteName(options.header ? names[col] : "c" + std::to_string(col + 1));
+        }
+        create += ")";
+        if (!Exec(db, create, failure)) return false;
+    }else if (options.header) {
+        // the file's columns, by name, in case the table has them in another order
+        insert += "(";
+        for (int col=0; col<columns; col++) {
+            if (col) insert += ", ";
+            insert += QuoteName(names[col]);
+        }
+        insert += ")";
+    }
+    insert += " values(";
+    for (int col=0; col<columns; col++) {
+        insert += col ? ", ?" : "?";
+    }
+    insert += ")";
+    if (sqlite3_prepare_v2(db, insert.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        *failure = sqlite3_errmsg(db);
+        return false;
+    }
+
+    // Cut the body into pieces at row boundaries. In a CSV file a newline
+    // inside quotes isn't one, and whether a place is inside quotes is
+    // whether an odd number of quotes come before it, so the quotes in
+    // each piece are counted first, in parallel.
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency() - 1;
+        threads = std::max(1, std::min(threads, max_parser_threads));
+    }
+    size_t chunks = std::max((size_t)1, (size_t)(end - body + parse_chunk_size - 1) / parse_chunk_size);
+    std::vector<const char *> bounds(chunks + 1);
+    for (size_t i=0; i<chunks; i++) {
+        bounds[i] = body + i * parse_chunk_size;
+    }
+    bounds[chunks] = end;
+
+    std::vector<unsigned char> in_quotes(chunks, 0);
+    if (options.format == ImportFormat_CSV && chunks > 1) {
+        std::vector<size_t> quotes(chunks);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> counters;
+        for (int t=0; t<threads; t++) {
+            counters.push_back(std::thread([&]{
+                for (size_t i; (i = next++) < chunks; ) {
+                    quotes[i] = Count(bounds[i], bounds[i+1], '"');
+                }
+            }));
+        }
+        for (std::thread& counter : counters) counter.join();
+        for (size_t i=1; i<chunks; i++) {
+            in_quotes[i] = in_quotes[i-1] ^ (quotes[i-1] & 1);
+        }
+    }
+
+    // Each piece starts with the first row that starts in it.
+    char quote = options.format == ImportFormat_CSV ? '"' : '\n';
+    Scanner newlines('\n', quote, '\n', quote);
+    for (size_t i=1; i<chunks; i++) {
+        const char *p = bounds[i];
+        bool quoted = in_quotes[i] != 0;
+        if (p[-1] != '\n' || quoted) {
+            for (;;) {
+                p = newlines.Find(p, end);
+                if (p == end) break;
+                if (*p++ != '\n') {
+                    quoted = !quoted;
+                }else if (!quoted) {
+                    break;
+                }
+            }
+        }
+        bounds[i] = std::max(p, bounds[i-1]);
+    }
+
+    // Parser threads work ahead of the inserter, as far as there are slots.
+    struct Shared
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        size_t next = 0;      // the next piece to parse
+        size_t inserted = 0;  // pieces that are done with
+        bool stop = false;
+    };
+    Shared shared;
+    size_t slots = (size_t)threads * chunks_ahead_per_thread;
+    std::vector<ParsedChunk> parsed(slots);
+    std::vector<std::thread> parsers;
+    for (int t=0; t<threads; t++) {
+        parsers.push_back(std::thread([&]{
+            RowParser row_parser(options.format);
+            for (;;) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(shared.mutex);
+                    shared.changed.wait(lock, [&]{
+                        return shared.stop || shared.next >= chunks || shared.next < shared.inserted + slots;
+                    });
+                    if (shared.stop || shared.next >= chunks) return;
+                    i = shared.next++;
+                }
+                ParsedChunk& chunk = parsed[i % slots];
+                chunk.Parse(&row_parser, bounds[i], bounds[i+1], columns);
+                {
+                    std::lock_guard<std::mutex> lock(shared.mutex);
+                    chunk.ready = true;
+                }
+                shared.changed.notify_all();
+            }
+        }));
+    }
+
+    // Optionally, no journal and no syncing while we're at it.
+    std::string journal_mode;
+    int synchronous = -1;
+    if (options.unsafe_fast) {
+        sqlite3_stmt *pragma = NULL;
+        if (sqlite3_prepare_v2(db, "pragma synchronous", -1, &pragma, NULL) == SQLITE_OK &&
+            sqlite3_step(pragma) == SQLITE_ROW) {
+            synchronous = sqlite3_column_int(pragma, 0);
+        }
+        sqlite3_finalize(pragma);
+        pragma = NULL;
+        if (!pool->IsWal() && sqlite3_prepare_v2(db, "pragma journal_mode", -1, &pragma, NULL) == SQLITE_OK &&
+            sqlite3_step(pragma) == SQLITE_ROW) {
+            journal_mode = (const char *)sqlite3_column_text(pragma, 0);
+        }
+        sqlite3_finalize(pragma);
+        if (synchronous >= 0) Exec(db, "pragma synchronous=off", failure);
+        if (!journal_mode.empty()) Exec(db, "pragma journal_mode=off", failure);
+    }
+
+    bool ok = failure->empty() && Exec(db, "begin", failure);
+    long long count = 0;
+    long long uncommitted = 0;
+    for (size_t i=0; ok && i<chunks && !cancelled; i++) {
+        ParsedChunk& chunk = parsed[i % slots];
+        {
+            std::unique_lock<std::mutex> lock(shared.mutex);
+            while (!chunk.ready && !cancelled) {
+                shared.changed.wait_for(lock, std::chrono::duration<double>(wait_seconds));
+            }
+        }
+        if (!chunk.ready) break;
+
+        const ImportValue *values = chunk.values.data();
+        for (long long row=0; row<chunk.rows && !cancelled; row++) {
+            for (int col=0; col<columns; col++) {
+                const ImportValue& value = *values++;
+                switch (value.type) {
+                case SQLITE_INTEGER: sqlite3_bind_int64(stmt, col+1, value.integer); break;
+                case SQLITE_FLOAT: sqlite3_bind_double(stmt, col+1, value.real); break;
+                case SQLITE_TEXT: sqlite3_bind_text(stmt, col+1, value.text, value.length, SQLITE_STATIC); break;
+                default: sqlite3_bind_null(stmt, col+1); break;
+                }
+            }
+            sqlite3_step(stmt);
+            if (sqlite3_reset(stmt) != SQLITE_OK) {
+                char where[64];
+                snprintf(where, sizeof(where), " (row %lld)", count + 1);
+                *failure = sqlite3_errmsg(db) + std::string(where);
+                ok = false;
+                break;
+            }
+            rows.store(++count, std::memory_order_relaxed);
+            if (++uncommitted == rows_per_transaction) {
+                uncommitted = 0;
+                ok = Exec(db, "commit", failure) && Exec(db, "begin", failure);
+                if (!ok) break;
+            }
+        }
+        if (ok && !cancelled) {
+            bytes = bounds[i+1] - data;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            chunk.Clear();
+            shared.inserted = i + 1;
+        }
+        shared.changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.stop = true;
+    }
+    shared.changed.notify_all();
+    for (std::thread& parser_thread : parsers) parser_thread.join();
+    sqlite3_finalize(stmt);
+
+    // What was inserted stays, even after an error or a cancel.
+    if (!sqlite3_get_autocommit(db) && !Exec(db, "commit", failure)) {
+        Exec(db, "rollback", failure);
+        ok = false;
+    }
+    if (synchronous >= 0) Exec(db, "pragma synchronous=" + std::to_string(synchronous), failure);
+    if (!journal_mode.empty()) Exec(db, "pragma journal_mode=" + journal_mode, failure);
+
+    return ok && failure->empty();
+}
@@ -0,0 +1,108 @@
+// Importer - loads a CSV or TSV file into a table, on threads of its own.
+//
+// The file is mapped into memory rather than read, and cut into pieces
+// at row boundaries that are parsed on several threads at once, scanning
+// for the few characters that matter a vector register at a time. The
+// parsed rows are inserted in file order, on the writer connection, by
+// one prepared statement that is reset and bound again for each row, with
+// a commit every few hundred thousand rows.
+//
+// CSV is read the way RFC 4180 writes it: quoted fields may hold commas,
+// quotes (doubled) and newlines, and an empty quoted field is '' where an
+// empty unquoted one is NULL. TSV fields are unquoted, with \t, \n, \r and
+// \\ escapes, and \N for NULL, as the Exporter writes them. Unquoted
+// fields that are numbers are inserted as numbers, anything else as text.
+//
+// A table that doesn't exist is created with a column for each field of
+// the first row, named by it if the file has a header, and no declared
+// types, so that each value keeps the type it was inserted with.
+//
+// Cancelling, or an error, stops the import where it is: the rows inserted
+// so far are committed, and stay.
+
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sqlite3.h>
+
+class ConnectionPool;
+
+enum ImportFormat
+{
+    ImportFormat_CSV,
+    ImportFormat_TSV,
+    ImportFormat_Count
+};
+
+const char *ImportFormatName(ImportFormat format);
+
+struct ImportOptions
+{
+    ImportFormat format = ImportFormat_CSV;
+    bool header = true;         // the first row names the columns
+    // Turn off the rollback journal and syncing for the duration, which
+    // is much faster, and leaves the database corrupt if the machine goes
+    // down halfway through. The journal is left alone in WAL mode, since
+    // leaving WAL would mean waiting for every reader to go away.
+    bool unsafe_fast = false;
+    int threads = 0;            // parser threads, 0 to use the cores there are
+};
+
+class Importer
+{
+public:
+    Importer();
+    ~Importer();
+
+    // Start importing the file at path into table, creating the table if
+    // needed. Returns false (see Error()) if an import is already running.
+    // The pool must outlive the import.
+    bool Start(ConnectionPool *pool, const std::string& path, const std::string& table,
+        const ImportOptions& options);
+
+    // Stop the import, if it is running, keeping the rows inserted so far.
+    void Cancel();
+
+    // Cancel, and wait for the threads to be done.
+    void Stop();
+
+    bool IsBusy() const;
+    double ElapsedSeconds() const;
+
+    // Progress so far, or in the end. Bytes are of the file, up to the end
+    // of the last row inserted.
+    long long Rows() const { return rows; }
+    long long Bytes() const { return bytes; }
+    long long FileSize() const { return file_size; }
+
+    const std::string& Table() const { return table; }
+    std::string Error() const;
+    bool WasCancelled() const { return cancelled; }
+
+private:
+    Importer(const Importer&);
+    Importer& operator=(const Importer&);
+
+    void Run(std::string path, ImportOptions options);
+    bool Load(const char *data, size_t size, sqlite3 *db, const ImportOptions& options, std::string *failure);
+
+    ConnectionPool *pool;
+    std::string table;
+    std::thread thread;
+
+    mutable std::mutex mutex;
+    // guarded by mutex
+    bool busy;
+    std::string error;
+    double start_time;
+    double end_time;
+
+    std::atomic<bool> cancelled;
+    std::atomic<long long> rows;
+    std::atomic<long long> bytes;
+    std::atomic<long long> file_size;
+};
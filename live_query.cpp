@@ -0,0 +1,203 @@
+#include "live_query.h"
+#include "connection_pool.h"
+#include "predicate.h"
+
+#include <chrono>
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LiveQuery::LiveQuery()
+: waiting(false)
+, run_time(0)
+, cancelled(false)
+, shown_run(0)
+, next_run(0)
+, shown_complete(false)
+, refined(false)
+{
+}
+
+LiveQuery::~LiveQuery()
+{
+    Close();
+}
+
+bool LiveQuery::Open(ConnectionPool *pool, std::string *error)
+{
+    Close();
+    worker.reset(new QueryWorker);
+    if (!worker->Open(pool, true)) {
+        *error = worker->Error();
+        worker.reset();
+        return false;
+    }
+    return true;
+}
+
+void LiveQuery::Close()
+{
+    worker.reset();
+
+    // whatever comes next runs afresh, on the new worker
+    pending.clear();
+    pending_version = DatabaseVersion();
+    running.clear();
+    running_version = DatabaseVersion();
+    waiting = false;
+    cancelled = false;
+    shown_run = 0;
+    next.Clear();
+    next_run = 0;
+    // a new connection's version numbers start over, so they prove nothing
+    shown_complete = false;
+}
+
+void LiveQuery::Update(const std::string& base, const std::string& where, const std::string& order_by,
+    const DatabaseVersion& version, double delay)
+{
+    Filter filter;
+    filter.base = base;
+    filter.where = where;
+    filter.order_by = order_by;
+    filter.valid = true;
+    // the newline ends any -- comment the filter finishes with
+    std::string query = base + " where (" + (where.empty() ? "1=1" : where) + "\n)" + order_by;
+
+    if (worker && (query != pending || version != pending_version) && Refine(filter, version)) {
+        // nothing left to wait for, or to run
+        pending = running = query;
+        pending_filter = running_filter = filter;
+        pending_version = running_version = version;
+        waiting = false;
+        if (worker->IsBusy()) {
+            worker->Cancel();
+            cancelled = true;
+        }
+        return;
+    }
+    Request(query, filter, version, delay);
+}
+
+void LiveQuery::Request(const std::string& query, const Filter& filter, const DatabaseVersion& version, double delay)
+{
+    if (!worker) return;
+
+    if (query != pending || version != pending_version) {
+        pending = query;
+        pending_filter = filter;
+        pending_version = version;
+        if (pending == running && pending_version == running_version && !cancelled) {
+            // back to what is running (or ran) already
+            waiting = false;
+        }else{
+            waiting = true;
+            run_time = Now() + delay;
+            // its rows would only be thrown away
+            if (worker->IsBusy()) {
+                worker->Cancel();
+                cancelled = true;
+            }
+        }
+    }
+
+    if (waiting && Now() >= run_time) {
+        waiting = false;
+        running = pending;
+        running_filter = pending_filter;
+        running_version = pending_version;
+        cancelled = false;
+        worker->Run(running);
+    }
+}
+
+bool LiveQuery::Poll()
+{
+    if (!worker) return false;
+
+    // once the worker has finished, this hands over all it has left
+    bool finished = !worker->IsBusy();
+    std::vector<std::unique_ptr<ResultSet> > incoming;
+    bool changed = worker->Poll(&incoming) && !cancelled && !incoming.empty() && Show(incoming[0].get());
+
+    if (finished && !cancelled && shown_run && shown_run == worker->CurrentRun() && !shown_complete) {
+        shown_complete = !result.HasError();
+    }
+    return changed;
+}
+
+// Move the latest rows from the worker into result, or on the side while a
+// new query has none yet. Returns true if Result() or Error() changed.
+bool LiveQuery::Show(ResultSet *latest)
+{
+    int run = worker->CurrentRun();
+    if (run == shown_run) {
+        if (latest->HasError()) {
+            error = latest->Error();
+        }
+        latest->MoveRowsTo(&result);
+        return true;
+    }
+
+    // A new query gathers its rows on the side, the old ones stay on show
+    // until it has some rows of its own, or turns out to have none.
+    if (run != next_run) {
+        next.Clear();
+        next_run = run;
+    }
+    latest->MoveRowsTo(&next);
+    if (next.HasError()) {
+        error = next.Error();
+        next.Clear();
+        next_run = 0;
+        return true;
+    }
+    if (next.Rows() == 0 && worker->IsBusy()) {
+        return false;
+    }
+    error.clear();
+    result.Clear();
+    next.MoveRowsTo(&result);
+    next.Clear();
+    shown_run = run;
+    next_run = 0;
+    shown_filter = running_filter;
+    shown_version = running_version;
+    shown_complete = false;
+    refined = false;
+    return true;
+}
+
+// If filter only narrows the one the rows on show came from, and we have
+// all of those rows, drop the ones that don't match it any more.
+bool LiveQuery::Refine(const Filter& filter, const DatabaseVersion& version)
+{
+    if (!shown_complete || !shown_filter.valid || shown_version != version) return false;
+    if (shown_filter.base != filter.base || shown_filter.order_by != filter.order_by) return false;
+
+    std::vector<PredicateTerm> wide = ParsePredicate(shown_filter.where);
+    std::vector<PredicateTerm> narrow = ParsePredicate(filter.where);
+    std::vector<unsigned char> keep;
+    if (!PredicateNarrows(narrow, wide) || !EvaluatePredicate(narrow, wide, result, &keep)) {
+        return false;
+    }
+    result.KeepRows(keep);
+    shown_filter = filter;
+    error.clear();
+    refined = true;
+    return true;
+}
+
+bool LiveQuery::IsBusy() const
+{
+    return waiting || (worker && worker->IsBusy());
+}
+
+double LiveQuery::SecondsUntilRun() const
+{
+    if (!waiting) return 0;
+    double seconds = run_time - Now();
+    return seconds > 0 ? seconds : 0;
+}
@@ -0,0 +1,106 @@
+// LiveQuery - a query that follows what the user is typing.
+//
+// The Tables tab turns its filter box into a new query on every keystroke.
+// Rather than running each half-typed one on the main thread, a LiveQuery
+// waits until the text has settled for a moment and then runs it on a
+// read-only worker of its own. A change while a query is still running
+// interrupts it straight away. The rows of the last query that worked stay
+// on show until the next one has some to replace them with.
+//
+// When the filter only gets narrower, and all the rows of the wider one are
+// here, the narrower filter is applied to them right away (see Predicate)
+// and SQLite isn't asked at all.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "database.h"
+#include "query_worker.h"
+#include "result_set.h"
+
+class ConnectionPool;
+
+class LiveQuery
+{
+public:
+    LiveQuery();
+    ~LiveQuery();
+
+    // Start or stop the worker, along with its reader connection.
+    // The rows on show stay, they are only rows.
+    bool Open(ConnectionPool *pool, std::string *error);
+    void Close();
+
+    // Call every frame with the query as it stands now: a base query, with
+    // a where clause and an order by clause (either may be empty). When the
+    // query or the database changes, the new query runs once it has stayed
+    // the same for delay seconds, unless the rows on show can be filtered
+    // instead.
+    void Update(const std::string& base, const std::string& where, const std::string& order_by,
+        const DatabaseVersion& version, double delay);
+
+    // Pick up whatever rows the worker has for us. Returns true if
+    // Result() or Error() changed.
+    bool Poll();
+
+    // The rows of the latest query that didn't fail as it started.
+    const ResultSet& Result() const { return result; }
+
+    // Why the latest query failed, if it did.
+    const std::string& Error() const { return error; }
+
+    // Whether the rows on show were filtered here, from those of a wider filter.
+    bool IsRefined() const { return refined; }
+
+    // Whether a query is waiting to run, or running.
+    bool IsBusy() const;
+
+    // How long until the waiting query runs, 0 if there is none.
+    double SecondsUntilRun() const;
+
+private:
+    LiveQuery(const LiveQuery&);
+    LiveQuery& operator=(const LiveQuery&);
+
+    // Where the rows of a query come from, for one with a where clause.
+    struct Filter
+    {
+        std::string base;
+        std::string where;
+        std::string order_by;
+        bool valid = false;
+    };
+
+    void Request(const std::string& query, const Filter& filter, const DatabaseVersion& version, double delay);
+    bool Show(ResultSet *latest);
+    bool Refine(const Filter& filter, const DatabaseVersion& version);
+
+    std::unique_ptr<QueryWorker> worker;
+
+    // the query as it was last seen
+    std::string pending;
+    Filter pending_filter;
+    DatabaseVersion pending_version;
+    bool waiting;
+    double run_time;  // when to run it
+
+    // the query the worker was last asked to run
+    std::string running;
+    Filter running_filter;
+    DatabaseVersion running_version;
+    bool cancelled;
+    int shown_run;  // the worker's run whose rows are in result
+    int next_run;   // the worker's run whose rows are in next
+
+    ResultSet result;
+    ResultSet next;
+    std::string error;
+
+    // what the rows in result are: all of them, if complete
+    Filter shown_filter;
+    DatabaseVersion shown_version;
+    bool shown_complete;
+    bool refined;
+};
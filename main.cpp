@@ -7,9 +7,26 @@
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
 #include <SDL.h>
 #include <sqlite3.h>
 #include "ImGuiColorTextEdit/TextEditor.h"
+#include "result_set.h"
+#include "bench.h"
+#include "connection_pool.h"
+#include "database.h"
+#include "exporter.h"
+#include "frame_timer.h"
+#include "importer.h"
+#include "live_query.h"
+#include "query_plan.h"
+#include "query_worker.h"
+#include "record_navigator.h"
+#include "schema_catalog.h"
+#include "statement_cache.h"
 
 // About Desktop OpenGL function loaders:
 //  Modern desktop OpenGL doesn't have a standard portable header file to load OpenGL function pointers.
@@ -35,44 +52,802 @@ using namespace gl;
 #include IMGUI_IMPL_OPENGL_LOADER_CUSTOM
 #endif
 
-void DisplayTable(char **result, int rows, int cols)
+// How much of a streaming result to load per frame, so the UI stays responsive.
+const int fetch_rows_per_frame = 10000;
+const double fetch_seconds_per_frame = 0.010;
+
+// Dear ImGui tables can't have more columns than this, so wider results
+// are shown through a window of this many columns that can be slid across.
+const int max_table_columns = 64;
+
+// How long the Tables tab's filter has to stay the same before it is run,
+// so that we don't query for every half-typed expression.
+const double filter_delay_seconds = 0.300;
+
+// How many prepared statements the main connection keeps around for reuse.
+const int statement_cache_size = 64;
+
+// How often an export's or import's progress is redrawn while it runs.
+const double progress_seconds = 0.100;
+
+// Where the time in each frame goes, for the frame time overlay.
+static FrameTimer frame_timer;
+
+// Returns true if the user clicked on a column header to change the sort
+// order, which is then in sort_keys. The caller does the actual sorting.
+bool DisplayTable(const ResultSet& result, std::vector<SortKey> *sort_keys)
 {
+    FrameTimer::Scope timing(&frame_timer, FramePhase_Table);
+    bool sort_changed = false;
+
     ImGuiTableFlags flags = 0
     | ImGuiTableFlags_Borders
     | ImGuiTableFlags_RowBg
     | ImGuiTableFlags_Resizable
-// | ImGuiTableFlags_Sortable  // we would have to sort the data ourselves
+    | ImGuiTableFlags_Sortable
+    | ImGuiTableFlags_SortMulti
+    | ImGuiTableFlags_SortTristate  // so results start out in their natural order
     | ImGuiTableFlags_ScrollY
+    | ImGuiTableFlags_ScrollX
     ;
 
+    int rows = result.Rows();
+    int total_cols = result.Columns();
+
+    // which columns are in the window?
+    int *first_col = ImGui::GetStateStorage()->GetIntRef(ImGui::GetID("first column"), 0);
+    int cols = total_cols;
+    if (total_cols > max_table_columns) {
+        cols = max_table_columns;
+        if (*first_col > total_cols - cols) {
+            *first_col = total_cols - cols;
+        }
+        ImGui::AlignTextToFramePadding();
+        ImGui::Text("Columns %d-%d of %d", *first_col + 1, *first_col + cols, total_cols);
+        ImGui::SameLine();
+        ImGui::SliderInt("##first column", first_col, 0, total_cols - cols, "");
+    }else{
+        *first_col = 0;
+    }
+
     if (cols>0 && ImGui::BeginTable("Result", cols, flags)) {
 
         for (int col=0; col<cols; col++) {
-            ImGui::TableSetupColumn(result[col]);
+            ImGui::TableSetupColumn(result.ColumnName(*first_col + col), 0, 0.0f, *first_col + col);
         }
         ImGui::TableSetupScrollFreeze(0, 1);
         ImGui::TableHeadersRow();
 
-        for (int row=0; row<rows; row++) {
-            ImGui::TableNextRow();
-            for (int col=0; col<cols; col++) {
-                ImGui::TableSetColumnIndex(col);
-                const char *text = result[(row+1)*cols+col];
-                if (text == NULL) {
-                    ImGui::TextDisabled("<NULL>");
-                }else{
-                    ImGui::TextUnformatted(text);
+        ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+        if (specs && specs->SpecsDirty) {
+            std::vector<SortKey> keys;
+            for (int i=0; i<specs->SpecsCount; i++) {
+                SortKey key;
+                key.column = specs->Specs[i].ColumnUserID;
+                key.descending = specs->Specs[i].SortDirection == ImGuiSortDirection_Descending;
+                keys.push_back(key);
+            }
+            specs->SpecsDirty = false;
+            if (keys != *sort_keys) {
+                *sort_keys = keys;
+                sort_changed = true;
+            }
+        }
+
+        // only submit the rows that are actually visible
+        char buf[64];
+        ImGuiListClipper clipper;
+        clipper.Begin(rows);
+        while (clipper.Step()) {
+            for (int row=clipper.DisplayStart; row<clipper.DisplayEnd; row++) {
+                ImGui::TableNextRow();
+                for (int col=0; col<cols; col++) {
+                    // ...and only the columns that are visible, too
+                    if (!ImGui::TableSetColumnIndex(col)) continue;
+                    const char *text = result.FormatCell(row, *first_col + col, buf, sizeof(buf));
+                    if (text == NULL) {
+                        ImGui::TextDisabled("<NULL>");
+                    }else{
+                        ImGui::TextUnformatted(text);
+                    }
                 }
             }
         }
 
         ImGui::EndTable();
     }
+
+    return sort_changed;
+}
+
+// Rows, timing and errors for the result of one statement.
+void DisplayStatementInfo(const ResultSet& result, bool running)
+{
+    if (result.HasError()) {
+        ImGui::Text("%s", result.Error().c_str());
+    }
+    if (result.NotRun()) {
+        return;
+    }
+    if (running) {
+        ImGui::Text("%d rows so far", result.Rows());
+    }else if (result.Columns() == 0) {
+        ImGui::Text("%d rows changed in %.3f sec, %d steps",
+            result.Changes(),
+            result.Seconds(),
+            result.VMSteps());
+    }else{
+        ImGui::Text("Result %d rows, %d cols in %.3f sec, %d steps",
+            result.Rows(),
+            result.Columns(),
+            result.Seconds(),
+            result.VMSteps());
+    }
+}
+
+// A table of statement profiles, most recent first.
+void DisplayProfiles(const char *label, const std::vector<const QueryProfile*>& profiles)
+{
+    ImGuiTableFlags flags = 0
+        | ImGuiTableFlags_Borders
+        | ImGuiTableFlags_RowBg
+        | ImGuiTableFlags_Resizable
+        ;
+    if (!ImGui::BeginTable(label, 7, flags)) return;
+
+    ImGui::TableSetupColumn("Query");
+    ImGui::TableSetupColumn("Time (ms)");
+    ImGui::TableSetupColumn("Full scan steps");
+    ImGui::TableSetupColumn("Sorts");
+    ImGui::TableSetupColumn("Auto indexes");
+    ImGui::TableSetupColumn("VM steps");
+    ImGui::TableSetupColumn("Cache bytes");
+    ImGui::TableHeadersRow();
+
+    for (int i=(int)profiles.size()-1; i>=0; i--) {
+        const QueryProfile& profile = *profiles[i];
+        ImGui::TableNextRow();
+
+        // just the first line here, all of it when hovered
+        ImGui::TableSetColumnIndex(0);
+        const char *sql = profile.sql.c_str();
+        const char *newline = strchr(sql, '\n');
+        ImGui::TextUnformatted(sql, newline);
+        if (newline && ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("%s", sql);
+        }
+
+        ImGui::TableSetColumnIndex(1);
+        ImGui::Text("%.3f", profile.seconds * 1000);
+        ImGui::TableSetColumnIndex(2);
+        ImGui::Text("%d", profile.fullscan_steps);
+        ImGui::TableSetColumnIndex(3);
+        ImGui::Text("%d", profile.sorts);
+        ImGui::TableSetColumnIndex(4);
+        ImGui::Text("%d", profile.autoindexes);
+        ImGui::TableSetColumnIndex(5);
+        ImGui::Text("%d", profile.vm_steps);
+        ImGui::TableSetColumnIndex(6);
+        ImGui::Text("%lld", (long long)profile.cache_bytes);
+    }
+    ImGui::EndTable();
+}
+
+void DisplayPlanNode(const QueryPlan& plan, int index)
+{
+    const PlanNode& node = plan.nodes[index];
+    ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_SpanFullWidth;
+    if (node.children.empty()) {
+        flags |= ImGuiTreeNodeFlags_Leaf;
+    }
+
+    bool open;
+    if (node.has_scan) {
+        open = ImGui::TreeNodeEx((void *)(intptr_t)node.id, flags,
+            "%s  (estimated %.0f rows per loop, actual %.1f rows per loop, %lld loops)%s",
+            node.detail.c_str(),
+            node.estimated_rows,
+            node.loops ? (double)node.rows / node.loops : 0.0,
+            (long long)node.loops,
+            node.same_detail ? " *" : "");
+    }else{
+        open = ImGui::TreeNodeEx((void *)(intptr_t)node.id, flags, "%s", node.detail.c_str());
+    }
+    if (open) {
+        for (size_t i=0; i<node.children.size(); i++) {
+            DisplayPlanNode(plan, node.children[i]);
+        }
+        ImGui::TreePop();
+    }
+}
+
+// The EXPLAIN QUERY PLAN tree of a statement.
+void DisplayPlan(const QueryPlan& plan)
+{
+    if (!plan.error.empty()) {
+        ImGui::Text("%s", plan.error.c_str());
+        return;
+    }
+    if (plan.nodes.empty()) {
+        ImGui::TextDisabled("No plan");
+        return;
+    }
+#ifndef SQLITE_ENABLE_STMT_SCANSTATUS
+    ImGui::TextDisabled("Build SQLite with SQLITE_ENABLE_STMT_SCANSTATUS to see actual loop counts");
+#endif
+    for (size_t i=0; i<plan.roots.size(); i++) {
+        DisplayPlanNode(plan, plan.roots[i]);
+    }
+#ifdef SQLITE_ENABLE_STMT_SCANSTATUS
+    for (size_t i=0; i<plan.nodes.size(); i++) {
+        if (plan.nodes[i].has_scan && plan.nodes[i].same_detail) {
+            ImGui::TextDisabled("* Actual counts are matched to lines by their text. Lines with the same text take them in order, which may not be theirs.");
+            break;
+        }
+    }
+#endif
+}
+
+// A small window with a rolling graph of each phase of the frame,
+// and the worst frames so far.
+void DisplayFrameTimes(FrameTimer& timer, bool *open)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x - 10, 10), ImGuiCond_Always, ImVec2(1, 0));
+    ImGui::SetNextWindowBgAlpha(0.85f);
+    ImGuiWindowFlags flags = 0
+        | ImGuiWindowFlags_AlwaysAutoResize
+        | ImGuiWindowFlags_NoSavedSettings
+        | ImGuiWindowFlags_NoFocusOnAppearing
+        | ImGuiWindowFlags_NoNav
+        ;
+    if (!ImGui::Begin("Frame Times", open, flags)) {
+        ImGui::End();
+        return;
+    }
+
+    for (int phase=0; phase<FramePhase_Count; phase++) {
+        const float *history = timer.History(phase);
+        float total = 0, max = 0;
+        for (int i=0; i<FrameTimer::history_size; i++) {
+            total += history[i];
+            if (history[i] > max) max = history[i];
+        }
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "avg %.2f ms, max %.2f ms", total / FrameTimer::history_size, max);
+        ImGui::PlotLines(FramePhaseName(phase), history, FrameTimer::history_size, timer.HistoryOffset(),
+            overlay, 0.0f, max > 16.7f ? max : 16.7f, ImVec2(240, 40));
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Worst frames (not counting Wait)");
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Reset")) {
+        timer.ResetWorst();
+    }
+    const std::vector<FrameTimer::Frame>& worst = timer.Worst();
+    if (ImGui::BeginTable("Worst", FramePhase_Count + 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Frame");
+        ImGui::TableSetupColumn("Total");
+        for (int phase=0; phase<FramePhase_Count; phase++) {
+            ImGui::TableSetupColumn(FramePhaseName(phase));
+        }
+        ImGui::TableHeadersRow();
+        for (size_t i=0; i<worst.size(); i++) {
+            const FrameTimer::Frame& frame = worst[i];
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Text("%d", frame.number);
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%.2f", frame.BusyMs());
+            for (int phase=0; phase<FramePhase_Count; phase++) {
+                ImGui::TableSetColumnIndex(phase + 2);
+                ImGui::Text("%.2f", frame.ms[phase]);
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+// For showing the catalog's tables in ImGui::Combo
+bool CatalogTableGetter(void *data, int idx, const char **out_text)
+{
+    const SchemaCatalog *catalog = (const SchemaCatalog *)data;
+    *out_text = catalog->Tables()[idx].name.c_str();
+    return true;
+}
+
+// A combo to pick one of the catalog's tables, which must not be empty.
+// The pick is kept by name, so it stays on the same table when others are
+// created or dropped. Returns the table picked.
+const CatalogTable& PickTable(const SchemaCatalog& catalog, std::string *selected)
+{
+    const std::vector<CatalogTable>& tables = catalog.Tables();
+    const CatalogTable *table = catalog.Find(selected->c_str());
+    int index = table ? (int)(table - tables.data()) : 0;
+    ImGui::Combo("Table", &index, CatalogTableGetter, (void *)&catalog, (int)tables.size());
+    *selected = tables[index].name;
+    return tables[index];
+}
+
+// The columns, indexes and foreign keys of a table, for the Tables tab.
+void DisplayCatalogTable(const CatalogTable& table)
+{
+    for (const CatalogColumn& column : table.columns) {
+        ImGui::BulletText("%s %s%s%s%s%s",
+            column.name.c_str(),
+            column.type.c_str(),
+            column.primary_key ? " primary key" : "",
+            column.not_null ? " not null" : "",
+            column.default_value.empty() ? "" : " default ",
+            column.default_value.c_str());
+    }
+    for (const CatalogIndex& index : table.indexes) {
+        ImGui::BulletText("%sindex %s%s",
+            index.unique ? "unique " : "",
+            index.name.c_str(),
+            index.partial ? " (partial)" : "");
+    }
+    for (const CatalogForeignKey& key : table.foreign_keys) {
+        ImGui::BulletText("%s references %s(%s)%s%s",
+            key.from.c_str(),
+            key.table.c_str(),
+            key.to.c_str(),
+            key.on_delete == "NO ACTION" ? "" : " on delete ",
+            key.on_delete == "NO ACTION" ? "" : key.on_delete.c_str());
+    }
+}
+
+// SQL, plus the tables and columns of the database as known identifiers,
+// so the editor highlights them and shows what they are on hover.
+TextEditor::LanguageDefinition SqlLanguage(const SchemaCatalog& catalog)
+{
+    TextEditor::LanguageDefinition lang = TextEditor::LanguageDefinition::SQL();
+
+    // SQL isn't case sensitive, so the editor looks up identifiers in upper case
+    auto add = [&](const std::string& name, const std::string& declaration) {
+        std::string key = name;
+        for (char& c : key) c = toupper((unsigned char)c);
+        TextEditor::Identifier& id = lang.mIdentifiers[key];
+        if (!id.mDeclaration.empty()) id.mDeclaration += "\n";
+        id.mDeclaration += declaration;
+    };
+    for (const CatalogTable& table : catalog.Tables()) {
+        std::string declaration = "table " + table.name + "(";
+        for (size_t i=0; i<table.columns.size(); i++) {
+            if (i) declaration += ", ";
+            declaration += table.columns[i].name;
+        }
+        add(table.name, declaration + ")");
+        for (const CatalogColumn& column : table.columns) {
+            add(column.name, table.name + "." + column.name + " " + column.type);
+        }
+    }
+    return lang;
+}
+
+// How well a statement cache is doing, for the Diagnostics tab.
+void DisplayStatementCache(const char *label, const StatementCache& statements)
+{
+    long long hits = statements.Hits();
+    long long misses = statements.Misses();
+    long long total = hits + misses;
+    ImGui::BulletText("%s: %d cached, %lld hits, %lld misses (%.1f%% hit rate)",
+        label,
+        statements.Size(),
+        hits,
+        misses,
+        total ? 100.0 * hits / total : 0.0);
+}
+
+// How much memory the text of some results takes, for the Diagnostics tab.
+void DisplayTextMemory(const char *label, size_t used, size_t allocated)
+{
+    ImGui::BulletText("%s: %.1f MB of text and blobs, in %.1f MB allocated",
+        label,
+        used / (1024.0 * 1024.0),
+        allocated / (1024.0 * 1024.0));
+}
+
+// One of the query tabs in the SQL tab: an editor, and the results of
+// running what is in it. Each tab has a worker, and so a reader connection,
+// of its own, so queries in different tabs run at the same time. The
+// results are plain rows, they stay until the tab is closed.
+struct QueryTab
+{
+    QueryTab(int id, const std::string& text)
+    : id(id)
+    , result_generation(0)
+    , pool(NULL)
+    , export_rows(0)
+    , export_format(ExportFormat_CSV)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "Query %d", id);
+        name = buf;
+        snprintf(export_path, sizeof(export_path), "export%s", ExportFormatExtension(ExportFormat_CSV));
+        snprintf(export_table, sizeof(export_table), "exported");
+
+        editor.SetLanguageDefinition(TextEditor::LanguageDefinition::SQL());
+        editor.SetShowWhitespaces(false);
+        TextEditor::Palette palette = TextEditor::GetLightPalette();
+        // disable the current line highlight, by choosing transparent colors for it.
+        palette[(int)TextEditor::PaletteIndex::CurrentLineFill] = 0x00000000;
+        palette[(int)TextEditor::PaletteIndex::CurrentLineFillInactive] = 0x00000000;
+        palette[(int)TextEditor::PaletteIndex::CurrentLineEdge] = 0x00000000;
+        editor.SetPalette(palette);
+        editor.SetText(text);
+    }
+
+    // Start a worker on a reader from the pool, or stop it and give the
+    // reader back. A query or export that is still running is cancelled.
+    bool Open(ConnectionPool *pool, std::string *error)
+    {
+        this->pool = pool;
+        worker.reset(new QueryWorker);
+        if (!worker->Open(pool)) {
+            *error = worker->Error();
+            worker.reset();
+            return false;
+        }
+        return true;
+    }
+    void Close()
+    {
+        exporter.Stop();
+        worker.reset();
+        pool = NULL;
+    }
+
+    int id;  // never reused, so ImGui state doesn't carry over to a new tab
+    std::string name;
+    TextEditor editor;
+    std::unique_ptr<QueryWorker> worker;
+
+    std::vector<std::unique_ptr<ResultSet> > results;
+    std::vector<std::vector<SortKey> > results_sort;
+    std::vector<QueryPlan> results_plan;
+    std::string result_unsorted_sql;
+    int result_generation;
+
+    // Exports run the statement again on a reader of their own.
+    ConnectionPool *pool;
+    Exporter exporter;
+    int export_rows;  // rows the result had when the export started, for its progress
+    int export_format;
+    char export_path[1024];
+    char export_table[256];
+
+private:
+    QueryTab(const QueryTab&);
+    QueryTab& operator=(const QueryTab&);
+};
+
+// Where to export a statement's result to, and in what format.
+void DisplayExportPopup(QueryTab& tab, const ResultSet& result)
+{
+    if (!ImGui::BeginPopup("Export")) return;
+
+    int format = tab.export_format;
+    for (int f=0; f<ExportFormat_Count; f++) {
+        if (f) ImGui::SameLine();
+        ImGui::RadioButton(ExportFormatName((ExportFormat)f), &tab.export_format, f);
+    }
+    if (tab.export_format != format) {
+        // keep the file's extension in step with the format
+        std::string path = tab.export_path;
+        std::string old_extension = ExportFormatExtension((ExportFormat)format);
+        if (path.size() >= old_extension.size() &&
+            path.compare(path.size() - old_extension.size(), old_extension.size(), old_extension) == 0) {
+            path.erase(path.size() - old_extension.size());
+            path += ExportFormatExtension((ExportFormat)tab.export_format);
+            snprintf(tab.export_path, sizeof(tab.export_path), "%s", path.c_str());
+        }
+    }
+    ImGui::InputText("File", tab.export_path, sizeof(tab.export_path));
+    if (tab.export_format == ExportFormat_SQL) {
+        ImGui::InputText("Table", tab.export_table, sizeof(tab.export_table));
+    }
+
+    if (tab.exporter.IsBusy()) {
+        ImGui::TextUnformatted("An export is already running.");
+    }else if (ImGui::Button("Export")) {
+        tab.export_rows = result.Rows();
+        tab.exporter.Start(tab.pool, result.Sql(), tab.export_path, (ExportFormat)tab.export_format,
+            tab.export_table);
+        ImGui::CloseCurrentPopup();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Close")) {
+        ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+}
+
+// How the tab's export is getting on, or how it went.
+void DisplayExportStatus(QueryTab& tab)
+{
+    Exporter& exporter = tab.exporter;
+    if (exporter.Path().empty()) return;
+
+    double seconds = exporter.ElapsedSeconds();
+    double megabytes = exporter.Bytes() / (1024.0 * 1024.0);
+    if (exporter.IsBusy()) {
+        float fraction = 0;
+        if (tab.export_rows > 0) {
+            fraction = (float)exporter.Rows() / tab.export_rows;
+            if (fraction > 1) fraction = 1;
+        }
+        char overlay[128];
+        snprintf(overlay, sizeof(overlay), "%lld rows, %.1f MB, %.1f MB/sec",
+            exporter.Rows(), megabytes, seconds > 0 ? megabytes / seconds : 0.0);
+        ImGui::ProgressBar(fraction, ImVec2(ImGui::GetContentRegionAvail().x * 0.5f, 0), overlay);
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Cancel Export")) {
+            exporter.Cancel();
+        }
+        ImGui::SetMaxWaitBeforeNextFrame(progress_seconds);
+    }else if (exporter.WasCancelled()) {
+        ImGui::Text("Export to %s cancelled", exporter.Path().c_str());
+    }else{
+        std::string error = exporter.Error();
+        if (!error.empty()) {
+            ImGui::Text("Export failed: %s", error.c_str());
+        }else{
+            ImGui::Text("Exported %lld rows, %.1f MB to %s in %.3f sec",
+                exporter.Rows(), megabytes, exporter.Path().c_str(), seconds);
+        }
+    }
+}
+
+// The editor, buttons and results of one query tab. Plans are explained
+// on the main thread's connection, which sees the same schema.
+void DisplayQueryTab(QueryTab& tab, StatementCache *statements, bool do_query)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    ImGuiStyle& style = ImGui::GetStyle();
+    TextEditor& editor = tab.editor;
+    QueryWorker *worker = tab.worker.get();
+
+    ImVec2 size(
+        ImGui::GetContentRegionAvail().x - 100 - style.FramePadding.x,
+        ImGui::GetTextLineHeight() * 5
+        );
+    editor.Render("SQL", size, true);
+    ImVec2 bottom_corner = ImGui::GetItemRectMax();
+
+    ImGui::SameLine();
+
+    bool busy = worker->IsBusy();
+
+    if (ImGui::BeginChild("Query Buttons", ImVec2(100,50))) {
+        if (busy) {
+            if (ImGui::Button("Cancel")) {
+                worker->Cancel();
+            }
+        }else if (ImGui::Button("Run Query")) {
+            do_query = true;
+        }
+        ImGui::Text("%s+Enter", io.ConfigMacOSXBehaviors ? "Cmd" : "Ctrl");
+    }
+    ImGui::EndChild();
+
+    auto shift = io.KeyShift;
+    auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
+    auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
+    if (ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_Enter), false)) {
+        do_query = true;
+    }
+
+    auto cpos = editor.GetCursorPosition();
+    auto selection = editor.GetSelectedText();
+    char info_text[1024];
+    if (selection.empty()) {
+        snprintf(info_text, sizeof(info_text),
+            "line %d/%d, column %d | %s",
+            cpos.mLine + 1,
+            editor.GetTotalLines(),
+            cpos.mColumn + 1,
+            editor.IsOverwrite() ? "Ovr" : "Ins");
+    }else{
+        snprintf(info_text, sizeof(info_text),
+            "selected %d characters | %s",
+            (int)selection.length(),
+            editor.IsOverwrite() ? "Ovr" : "Ins");
+    }
+
+    ImVec2 pos = ImGui::GetCursorPos();
+    ImGui::SetCursorPosX(bottom_corner.x - ImGui::CalcTextSize(info_text).x);
+    ImGui::TextUnformatted(info_text);
+    // ImGui::SetItemAllowOverlap();
+    ImGui::SetCursorPos(pos);
+
+    std::vector<std::unique_ptr<ResultSet> >& results = tab.results;
+
+    if (do_query) {
+        // this cancels the previous query, if it is still running
+        tab.result_unsorted_sql.clear();
+        tab.results_sort.clear();
+        tab.results_plan.clear();
+        tab.result_generation++;
+        worker->Run(editor.GetText());
+        busy = true;
+    }
+
+    if (busy) {
+        ImGui::Text("Running... %.1f sec, %lld steps, %d statements so far",
+            worker->ElapsedSeconds(),
+            worker->Steps(),
+            (int)results.size());
+    }else if (results.size() > 1) {
+        ImGui::Text("%d statements in %.3f sec",
+            (int)results.size(),
+            worker->ElapsedSeconds());
+    }
+    DisplayExportStatus(tab);
+    tab.results_sort.resize(results.size());
+    tab.results_plan.resize(results.size());
+
+    // a fresh table for each new query, so that it starts out unsorted
+    ImGui::PushID(tab.result_generation);
+
+    // a script gets one sub-tab per statement
+    bool tabs = results.size() > 1 && ImGui::BeginTabBar("Statements");
+    for (size_t i=0; i<results.size(); i++) {
+        ResultSet& result = *results[i];
+        std::vector<SortKey>& result_sort = tab.results_sort[i];
+
+        if (tabs) {
+            // label the tab with the start of the statement
+            std::string sql = result.Sql().substr(0, 40);
+            size_t newline = sql.find('\n');
+            if (newline != std::string::npos) sql.erase(newline);
+            char label[128];
+            snprintf(label, sizeof(label), "%d: %s%s###%d",
+                (int)i+1, sql.c_str(), result.NotRun() ? " (not run)" : result.HasError() ? " (error)" : "", (int)i);
+            if (!ImGui::BeginTabItem(label)) continue;
+        }
+        ImGui::PushID((int)i);
+
+        DisplayStatementInfo(result, busy && i == results.size()-1);
+        if (result.Columns() > 0 && !(busy && i == results.size()-1)) {
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Export...")) {
+                ImGui::OpenPopup("Export");
+            }
+            DisplayExportPopup(tab, result);
+        }
+
+        if (ImGui::BeginTabBar("View")) {
+            if (ImGui::BeginTabItem("Result")) {
+                if (DisplayTable(result, &result_sort)) {
+                    if (results.size() == 1 && result.CanRequery()) {
+                        // let SQLite do the sorting, it may be able to use an index
+                        if (tab.result_unsorted_sql.empty()) {
+                            tab.result_unsorted_sql = result.Sql();
+                        }
+                        worker->Run(SortedQuery(tab.result_unsorted_sql, result_sort));
+                        busy = true;
+                    }else{
+                        result.Sort(result_sort);
+                    }
+                }
+                ImGui::EndTabItem();
+            }
+            if (ImGui::BeginTabItem("Plan")) {
+                QueryPlan& plan = tab.results_plan[i];
+                if (plan.sql != result.Sql()) {
+                    FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+                    plan.Load(statements, result.Sql());
+                }
+                plan.Annotate(result.Scans());
+                DisplayPlan(plan);
+                ImGui::EndTabItem();
+            }
+            ImGui::EndTabBar();
+        }
+
+        // rows that arrived after an in-memory sort get sorted in once they're all here
+        if (!busy && result.NeedsSort()) {
+            result.Sort(result.SortKeys());
+        }
+
+        ImGui::PopID();
+        if (tabs) ImGui::EndTabItem();
+    }
+    if (tabs) ImGui::EndTabBar();
+
+    ImGui::PopID();
+}
+
+// The Import tab: a CSV or TSV file to load into a table, and how that's going.
+void DisplayImport(Importer& importer, ConnectionPool *pool, bool read_only)
+{
+    static char path[1024] = "";
+    static char table[256] = "imported";
+    static ImportOptions options;
+
+    if (read_only) {
+        ImGui::TextUnformatted("The database is open read-only.");
+        return;
+    }
+
+    bool busy = importer.IsBusy();
+    if (ImGui::InputText("File", path, sizeof(path))) {
+        // guess the format from the extension
+        size_t length = strlen(path);
+        if (length >= 4 && !sqlite3_stricmp(path + length - 4, ".tsv")) options.format = ImportFormat_TSV;
+        if (length >= 4 && !sqlite3_stricmp(path + length - 4, ".csv")) options.format = ImportFormat_CSV;
+    }
+    ImGui::InputText("Table", table, sizeof(table));
+    ImGui::SameLine();
+    ImGui::TextDisabled("(created if it doesn't exist)");
+    int format = options.format;
+    for (int f=0; f<ImportFormat_Count; f++) {
+        if (f) ImGui::SameLine();
+        ImGui::RadioButton(ImportFormatName((ImportFormat)f), &format, f);
+    }
+    options.format = (ImportFormat)format;
+    ImGui::Checkbox("First row is a header", &options.header);
+    ImGui::Checkbox("No journal or syncing while importing (unsafe if the machine goes down)", &options.unsafe_fast);
+
+    if (busy) {
+        double seconds = importer.ElapsedSeconds();
+        float fraction = importer.FileSize() > 0 ? (float)((double)importer.Bytes() / importer.FileSize()) : 0;
+        char overlay[128];
+        snprintf(overlay, sizeof(overlay), "%lld rows, %.0f rows/sec",
+            importer.Rows(), seconds > 0 ? importer.Rows() / seconds : 0.0);
+        ImGui::ProgressBar(fraction, ImVec2(ImGui::GetContentRegionAvail().x * 0.5f, 0), overlay);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) {
+            importer.Cancel();
+        }
+        ImGui::SetMaxWaitBeforeNextFrame(progress_seconds);
+        return;
+    }
+
+    if (ImGui::Button("Import")) {
+        importer.Start(pool, path, table, options);
+        return;
+    }
+    if (importer.Table().empty()) return;
+
+    std::string error = importer.Error();
+    double seconds = importer.ElapsedSeconds();
+    if (importer.WasCancelled()) {
+        ImGui::Text("Import cancelled, after %lld rows into %s", importer.Rows(), importer.Table().c_str());
+    }else if (!error.empty()) {
+        ImGui::Text("Import failed after %lld rows: %s", importer.Rows(), error.c_str());
+    }else{
+        ImGui::Text("Imported %lld rows into %s in %.3f sec, %.0f rows/sec",
+            importer.Rows(), importer.Table().c_str(), seconds, seconds > 0 ? importer.Rows() / seconds : 0.0);
+    }
 }
 
 // Main code
 int main(int argc, char**argv)
 {
+    // no window at all when benchmarking
+    if (argc > 1 && !strcmp(argv[1], "--bench")) {
+        return RunBenchmark(argc - 2, argv + 2);
+    }
+
+    // options may come anywhere, the rest are the database and the SQL
+    OpenOptions open_options;
+    std::vector<const char *> args;
+    for (int i=1; i<argc; i++) {
+        std::string option_error;
+        if (!ParseOpenOption(argc, argv, &i, &open_options, &option_error)) {
+            args.push_back(argv[i]);
+        }else if (!option_error.empty()) {
+            fprintf(stderr, "Usage: sql-gui [--readonly] [--immutable] [--mmap-size size] [database [sql]]\n");
+            fprintf(stderr, "%s\n", option_error.c_str());
+            return 2;
+        }
+    }
+
     // Setup SDL
     // (Some versions of SDL before <2.0.10 appears to have performance/stalling issues on a minority of Windows systems,
     // depending on whether SDL_INIT_GAMECONTROLLER is enabled or disabled.. updating to latest version of SDL is recommended!)
@@ -173,38 +948,85 @@ int main(int argc, char**argv)
 
     // Our state
     bool show_demo_window = true;
+    bool show_frame_times = false;
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
-    const char* db_path = argc>1 ? argv[1] : "";
-    char *err_msg = NULL;
-    sqlite3 *db;
-    int rc;
-    rc = sqlite3_open(db_path, &db);
-    if (rc) {
-        fprintf(stderr, "Failed to open database %s: %s", db_path, sqlite3_errmsg(db));
-        sqlite3_close(db);
+    const char* db_path = args.size()>0 ? args[0] : "";
+
+    // Every connection to the database comes from the pool. The browsing
+    // tabs read on a connection of their own, db.
+    ConnectionPool pool;
+    sqlite3 *db = NULL;
+
+    // Each query tab in the SQL tab runs its queries on a connection of its
+    // own, on a background thread. The Profiler tab follows the one that was
+    // shown last.
+    std::vector<std::unique_ptr<QueryTab> > query_tabs;
+    int next_query_id = 1;
+    size_t current_query = 0;
+    query_tabs.push_back(std::unique_ptr<QueryTab>(new QueryTab(next_query_id++,
+        args.size()>1 ? args[1] : "select * from sqlite_master")));
+
+    // Statements on the main thread's connection are prepared once and reused,
+    // the version checks in particular run every frame.
+    std::unique_ptr<StatementCache> statements;
+
+
+    // Every list of tables comes from here. It is read again only when the schema changes.
+    SchemaCatalog catalog;
+    // Filtering a big table can take a while, so it runs in the background.
+    LiveQuery tables_contents;
+    RecordNavigator records;
+    // Loading a file takes the writer for as long as it runs.
+    Importer importer;
+
+    // Everything holding statements from the old connections has to go
+    // before they can be closed. Query results are only rows, they stay.
+    auto close_database = [&]() {
+        importer.Stop();
+        catalog.Clear();
+        tables_contents.Close();
+        records.Close();
+        statements.reset();
+        for (size_t i=0; i<query_tabs.size(); i++) {
+            query_tabs[i]->Close();
+        }
+        pool.ReleaseReader(db);
+        db = NULL;
+        pool.Close();
+    };
+    auto open_database = [&](const OpenOptions& options, std::string *error) -> bool {
+        close_database();
+        if (!pool.Open(db_path, options)) {
+            *error = pool.Error();
+            return false;
+        }
+        db = pool.AcquireReader();
+        if (!db) {
+            *error = "No reader connection";
+            close_database();
+            return false;
+        }
+        for (size_t i=0; i<query_tabs.size(); i++) {
+            if (!query_tabs[i]->Open(&pool, error)) {
+                close_database();
+                return false;
+            }
+        }
+        if (!tables_contents.Open(&pool, error)) {
+            close_database();
+            return false;
+        }
+        statements.reset(new StatementCache(db, statement_cache_size));
+        return true;
+    };
+
+    std::string open_error;
+    if (!open_database(open_options, &open_error)) {
+        fprintf(stderr, "Failed to open database %s: %s\n", db_path, open_error.c_str());
         exit(1);
     }
 
-    char query[1024];
-    char **result = NULL;
-    int result_rows = 0;
-    int result_cols = 0;
-
-    snprintf(query, sizeof(query), "%s", argc>2 ? argv[2] : "select * from sqlite_master");
-
-    TextEditor editor;
-    auto lang = TextEditor::LanguageDefinition::SQL();
-    editor.SetLanguageDefinition(lang);
-    editor.SetShowWhitespaces(false);
-    TextEditor::Palette palette = TextEditor::GetLightPalette();
-    // disable the current line highlight, by choosing transparent colors for it.
-    palette[(int)TextEditor::PaletteIndex::CurrentLineFill] = 0x00000000;
-    palette[(int)TextEditor::PaletteIndex::CurrentLineFillInactive] = 0x00000000;
-    palette[(int)TextEditor::PaletteIndex::CurrentLineEdge] = 0x00000000;
-    editor.SetPalette(palette);
-    editor.SetText(query);
-
     // Main loop
     bool done = false;
     while (!done)
@@ -214,15 +1036,19 @@ int main(int argc, char**argv)
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
         // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
         // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-        ImGui_ImplSDL2_WaitForEvent();
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
+        frame_timer.BeginFrame();
         {
-            ImGui_ImplSDL2_ProcessEvent(&event);
-            if (event.type == SDL_QUIT)
-                done = true;
-            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(window))
-                done = true;
+            FrameTimer::Scope timing(&frame_timer, FramePhase_Wait);
+            ImGui_ImplSDL2_WaitForEvent();
+            SDL_Event event;
+            while (SDL_PollEvent(&event))
+            {
+                ImGui_ImplSDL2_ProcessEvent(&event);
+                if (event.type == SDL_QUIT)
+                    done = true;
+                if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(window))
+                    done = true;
+            }
         }
 
         // Start the Dear ImGui frame
@@ -233,6 +1059,35 @@ int main(int argc, char**argv)
         if (show_demo_window)
             ImGui::ShowDemoWindow(&show_demo_window);
 
+        // Keep loading any results that are still streaming in, a bit each frame.
+        {
+            FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+            // once a frame, rather than on every statement we look up
+            statements->CheckSchema();
+            // which tables exist? the editors learn their names too
+            if (catalog.Update(statements.get())) {
+                TextEditor::LanguageDefinition lang = SqlLanguage(catalog);
+                for (size_t i=0; i<query_tabs.size(); i++) {
+                    query_tabs[i]->editor.SetLanguageDefinition(lang);
+                }
+            }
+
+            // the filtered table, once the filter has settled
+            tables_contents.Poll();
+            if (tables_contents.IsBusy()) {
+                ImGui::SetMaxWaitBeforeNextFrame(tables_contents.SecondsUntilRun());
+            }
+
+            // pick up whatever the query workers have produced so far
+            for (size_t i=0; i<query_tabs.size(); i++) {
+                QueryWorker *worker = query_tabs[i]->worker.get();
+                worker->Poll(&query_tabs[i]->results);
+                if (worker->IsBusy()) {
+                    ImGui::SetMaxWaitBeforeNextFrame(0.0);
+                }
+            }
+        }
+
         {
             bool do_query = false;
 
@@ -240,108 +1095,103 @@ int main(int argc, char**argv)
 
             ImGui::SetNextWindowPos(ImVec2(0,0), ImGuiCond_Always);
             ImGui::SetNextWindowSize(io.DisplaySize, ImGuiCond_Always);
-            ImGui::Begin("Database");
-
-            if (ImGui::BeginTabBar("##tabs", ImGuiTabBarFlags_None)) {
-
-                if (ImGui::BeginTabItem("SQL")) {
-
-                    ImVec2 size(
-                        ImGui::GetContentRegionAvail().x - 100 - style.FramePadding.x,
-                        ImGui::GetTextLineHeight() * 5
-                        );
-                    editor.Render("SQL", size, true);
-                    ImVec2 bottom_corner = ImGui::GetItemRectMax();
-
-                    ImGui::SameLine();
-
-                    if (ImGui::BeginChild("Query Buttons", ImVec2(100,50))) {
-                        if (ImGui::Button("Run Query")) {
-                            do_query = true;
-                        }
-                        ImGui::Text("%s+Enter", io.ConfigMacOSXBehaviors ? "Cmd" : "Ctrl");
+            // never in front of the frame time overlay
+            ImGui::Begin("Database", NULL, ImGuiWindowFlags_NoBringToFrontOnFocus | ImGuiWindowFlags_MenuBar);
+
+            if (ImGui::BeginMenuBar()) {
+                // reopening the in-memory database would lose it
+                bool has_file = strlen(db_path) && strcmp(db_path, ":memory:");
+                if (ImGui::BeginMenu("File", has_file)) {
+                    // any change reopens both connections
+                    OpenOptions options = open_options;
+                    bool reopen = false;
+                    if (ImGui::MenuItem("Read-Only", NULL, &options.readonly)) {
+                        if (!options.readonly) options.immutable = false;
+                        reopen = true;
+                    }
+                    if (ImGui::MenuItem("Immutable", NULL, &options.immutable, options.readonly)) {
+                        reopen = true;
                     }
-                    ImGui::EndChild();
-
-                    ImGuiIO& io = ImGui::GetIO();
-                    auto shift = io.KeyShift;
-                    auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
-                    auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
-                    if (ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_Enter), false)) {
-                        do_query = true;
+                    static int mmap_mb = -1;
+                    if (mmap_mb < 0) {
+                        mmap_mb = open_options.mmap_size > 0 ? (int)(open_options.mmap_size >> 20) : 0;
+                    }
+                    ImGui::SetNextItemWidth(120);
+                    ImGui::InputInt("mmap size (MB)", &mmap_mb, 0, 0);
+                    if (mmap_mb < 0) mmap_mb = 0;
+                    if (ImGui::IsItemDeactivatedAfterEdit()) {
+                        options.mmap_size = (sqlite3_int64)mmap_mb << 20;
+                        reopen = true;
                     }
 
-                    auto cpos = editor.GetCursorPosition();
-                    auto selection = editor.GetSelectedText();
-                    char info_text[1024];
-                    if (selection.empty()) {
-                        snprintf(info_text, sizeof(info_text),
-                            "line %d/%d, column %d | %s",
-                            cpos.mLine + 1,
-                            editor.GetTotalLines(),
-                            cpos.mColumn + 1,
-                            editor.IsOverwrite() ? "Ovr" : "Ins");
-                    }else{
-                        snprintf(info_text, sizeof(info_text),
-                            "selected %d characters | %s",
-                            (int)selection.length(),
-                            editor.IsOverwrite() ? "Ovr" : "Ins");
+                    if (reopen) {
+                        if (open_database(options, &open_error)) {
+                            open_options = options;
+                            open_error.clear();
+                        }else{
+                            // back to how it was
+                            fprintf(stderr, "Failed to reopen database %s: %s\n", db_path, open_error.c_str());
+                            std::string error;
+                            if (!open_database(open_options, &error)) {
+                                fprintf(stderr, "Failed to open database %s: %s\n", db_path, error.c_str());
+                                exit(1);
+                            }
+                        }
                     }
+                    ImGui::EndMenu();
+                }
 
-                    ImVec2 pos = ImGui::GetCursorPos();
-                    ImGui::SetCursorPosX(bottom_corner.x - ImGui::CalcTextSize(info_text).x);
-                    ImGui::TextUnformatted(info_text);
-                    // ImGui::SetItemAllowOverlap();
-                    ImGui::SetCursorPos(pos);
+                ImGui::TextDisabled("%s%s",
+                    has_file ? db_path : "(in memory)",
+                    open_options.immutable ? " (immutable)" : open_options.readonly ? " (read-only)" : "");
+                if (!open_error.empty()) {
+                    ImGui::SameLine();
+                    ImGui::Text("%s", open_error.c_str());
+                }
+                ImGui::EndMenuBar();
+            }
 
-                    if (do_query) {
-                        if (err_msg) {
-                            sqlite3_free(err_msg);
-                            err_msg = NULL;
-                        }
+            if (ImGui::BeginTabBar("##tabs", ImGuiTabBarFlags_None)) {
 
-                        snprintf(query, sizeof(query), "%s", editor.GetText().c_str());
-
-                        char **new_result = NULL;
-                        int new_rows = 0;
-                        int new_cols = 0;
-                        rc = sqlite3_get_table(
-                            db,
-                            query,
-                            &new_result,
-                            &new_rows,
-                            &new_cols,
-                            &err_msg
-                            );
-                        if (rc != SQLITE_OK) {
-                            fprintf(stderr, "SQL error: %s\n", err_msg);
-                            if (new_result) {
-                                sqlite3_free_table(new_result);
-                            }
-                        }else if (new_cols>64) {
-                            fprintf(stderr, "Error %d > 64 columns\n", new_cols);
-                            if (new_result) {
-                                sqlite3_free_table(new_result);
+                if (ImGui::BeginTabItem("SQL")) {
+
+                    size_t close_query = query_tabs.size();
+                    if (ImGui::BeginTabBar("Queries", ImGuiTabBarFlags_Reorderable | ImGuiTabBarFlags_AutoSelectNewTabs)) {
+                        for (size_t i=0; i<query_tabs.size(); i++) {
+                            QueryTab& tab = *query_tabs[i];
+                            char label[64];
+                            snprintf(label, sizeof(label), "%s%s###%d",
+                                tab.name.c_str(), tab.worker->IsBusy() ? " (running)" : "", tab.id);
+                            // the last one stays, there's always somewhere to type
+                            bool open = true;
+                            if (ImGui::BeginTabItem(label, query_tabs.size() > 1 ? &open : NULL)) {
+                                current_query = i;
+                                ImGui::PushID(tab.id);
+                                DisplayQueryTab(tab, statements.get(), do_query);
+                                ImGui::PopID();
+                                ImGui::EndTabItem();
                             }
-                        }else{
-                            if (result) {
-                                sqlite3_free_table(result);
-                                result = NULL;
+                            if (!open) close_query = i;
+                        }
+                        if (ImGui::TabItemButton("+", ImGuiTabItemFlags_Trailing | ImGuiTabItemFlags_NoTooltip)) {
+                            std::unique_ptr<QueryTab> tab(new QueryTab(next_query_id++, ""));
+                            tab->editor.SetLanguageDefinition(SqlLanguage(catalog));
+                            std::string error;
+                            if (tab->Open(&pool, &error)) {
+                                query_tabs.push_back(std::move(tab));
+                            }else{
+                                fprintf(stderr, "Failed to open a query tab: %s\n", error.c_str());
                             }
-                            result = new_result;
-                            result_rows = new_rows;
-                            result_cols = new_cols;
                         }
+                        ImGui::EndTabBar();
                     }
 
-                    if (err_msg) {
-                        ImGui::Text("%s", err_msg);
-                    }
-
-                    if (result) {
-                        ImGui::Text("Result %d rows, %d cols", result_rows, result_cols);
-
-                        DisplayTable(result, result_rows, result_cols);
+                    // this cancels its query, if it is still running, and frees its results
+                    if (close_query < query_tabs.size()) {
+                        query_tabs.erase(query_tabs.begin() + close_query);
+                        if (current_query >= query_tabs.size()) {
+                            current_query = query_tabs.size() - 1;
+                        }
                     }
 
                     ImGui::EndTabItem();
@@ -349,63 +1199,55 @@ int main(int argc, char**argv)
 
                 if (ImGui::BeginTabItem("Tables")) {
 
-                    char **result = NULL;
-                    int rows = 0;
-                    int cols = 0;
-
-                    // which tables exist?
-                    rc = sqlite3_get_table(
-                        db,
-                        "select name from sqlite_master where type='table'",
-                        &result,
-                        &rows,
-                        &cols,
-                        &err_msg
-                        );
-                    if (rc != SQLITE_OK) {
-                        fprintf(stderr, "SQL error: %s\n", err_msg);
-                        if (result) {
-                            sqlite3_free_table(result);
-                        }
-                    }else{
+                    DatabaseVersion version;
+                    {
+                        FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+                        version = GetDatabaseVersion(statements.get());
+                    }
+                    if (!catalog.Error().empty()) {
+                        ImGui::Text("Couldn't read the schema: %s", catalog.Error().c_str());
+                    }
+                    if (!catalog.Tables().empty()) {
 
-                        // pick a table
-                        static int selected_table_index = 0;
-                        ImGui::Combo("Table", &selected_table_index, &result[1], rows);
+                        static std::string selected_table;
+                        const CatalogTable& table_info = PickTable(catalog, &selected_table);
 
                         static char filter[1024];
-                        ImGui::InputText("Filter", filter, sizeof(filter));
-
-                        char q[256];
-                        const char *where = filter;
-                        if (!strlen(where)) {
-                            where = "1=1";
+                        bool typed = ImGui::InputText("Filter", filter, sizeof(filter));
+
+                        const char *table = table_info.name.c_str();
+                        static std::map<std::string, std::vector<SortKey> > sorts;
+                        std::vector<SortKey>& sort = sorts[table];
+
+                        // query the full contents of the table, but only when
+                        // the table, filter or database has changed, and only
+                        // once the user has stopped typing. A filter that only
+                        // narrows the last one is applied to the rows we have.
+                        tables_contents.Update("select * from " + QuoteIdentifier(table), filter, OrderByClause(sort),
+                            version, typed ? filter_delay_seconds : 0.0);
+
+                        // the last rows we had stay until the new ones arrive
+                        const ResultSet& contents = tables_contents.Result();
+                        if (!tables_contents.Error().empty()) {
+                            ImGui::Text("%s", tables_contents.Error().c_str());
+                        }
+                        ImGui::Text("%d rows, %d cols%s",
+                            contents.Rows(),
+                            contents.Columns(),
+                            tables_contents.IsBusy() ? " (loading...)" : tables_contents.IsRefined() ? " (filtered from the previous rows)" : "");
+
+                        if (ImGui::TreeNode("Schema")) {
+                            DisplayCatalogTable(table_info);
+                            ImGui::TreePop();
                         }
-                        snprintf(q, sizeof(q), "select * from %s where %s", result[selected_table_index+1], where);
-
-                        // free the list of tables
-                        sqlite3_free_table(result);
-
-                        // query the full contents of the table
-                        rc = sqlite3_get_table(
-                            db,
-                            q,
-                            &result,
-                            &rows,
-                            &cols,
-                            &err_msg
-                            );
-                        if (rc != SQLITE_OK) {
-                            fprintf(stderr, "SQL error: %s\n", err_msg);
-                            if (result) {
-                                sqlite3_free_table(result);
-                            }
-                        }else{
-                            ImGui::Text("%d rows, %d cols", rows, cols);
 
-                            DisplayTable(result, rows, cols);
-                            sqlite3_free_table(result);
+                        // each table gets its own sort order
+                        ImGui::PushID(table);
+                        if (DisplayTable(contents, &sort)) {
+                            // picked up next frame, by re-running the query with an "order by"
+                            ImGui::SetMaxWaitBeforeNextFrame(0.0);
                         }
+                        ImGui::PopID();
                     }
 
 
@@ -414,58 +1256,36 @@ int main(int argc, char**argv)
 
                 if (ImGui::BeginTabItem("Records")) {
 
-                    char **result = NULL;
-                    int rows = 0;
-                    int cols = 0;
-
-                    // which tables exist?
-                    rc = sqlite3_get_table(
-                        db,
-                        "select name from sqlite_master where type='table'",
-                        &result,
-                        &rows,
-                        &cols,
-                        &err_msg
-                        );
-                    if (rc != SQLITE_OK) {
-                        fprintf(stderr, "SQL error: %s\n", err_msg);
-                        if (result) {
-                            sqlite3_free_table(result);
-                        }
-                    }else{
+                    DatabaseVersion version;
+                    {
+                        FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+                        version = GetDatabaseVersion(statements.get());
+                    }
+                    if (!catalog.Error().empty()) {
+                        ImGui::Text("Couldn't read the schema: %s", catalog.Error().c_str());
+                    }
+                    if (!catalog.Tables().empty()) {
 
-                        // pick a table
-                        static int selected_table_index = 0;
-                        ImGui::Combo("Table", &selected_table_index, &result[1], rows);
+                        static std::string selected_table;
+                        const CatalogTable& table_info = PickTable(catalog, &selected_table);
 
                         static char filter[1024];
                         ImGui::InputText("Filter", filter, sizeof(filter));
 
-                        char q[256];
                         const char *where = filter;
                         if (!strlen(where)) {
                             where = "1=1";
                         }
-                        snprintf(q, sizeof(q), "select * from %s where %s", result[selected_table_index+1], where);
-
-                        // free the list of tables
-                        sqlite3_free_table(result);
-
-                        // query the full contents of the table
-                        rc = sqlite3_get_table(
-                            db,
-                            q,
-                            &result,
-                            &rows,
-                            &cols,
-                            &err_msg
-                            );
-                        if (rc != SQLITE_OK) {
-                            fprintf(stderr, "SQL error: %s\n", err_msg);
-                            if (result) {
-                                sqlite3_free_table(result);
-                            }
+
+                        // prepare to fetch records one at a time
+                        {
+                            FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+                            records.Open(db, table_info.name.c_str(), where, version);
+                        }
+                        if (!records.error.empty()) {
+                            ImGui::Text("%s", records.error.c_str());
                         }else{
+                            int rows = records.count;
 
                             // Pick one record
                             static int record_index = 1;
@@ -488,18 +1308,23 @@ int main(int argc, char**argv)
 
                             ImGui::SliderInt("Record Index", &record_index, 1, rows);
 
+                            {
+                                FrameTimer::Scope timing(&frame_timer, FramePhase_Queries);
+                                records.Goto(record_index);
+                            }
+                            const Record& record = records.current;
+
                             ImGuiTableFlags flags = 0
                             | ImGuiTableFlags_Borders
                             | ImGuiTableFlags_RowBg
                             | ImGuiTableFlags_Resizable
                             | ImGuiTableFlags_ScrollY
                             ;
-                            if (ImGui::BeginTable("Record", 2, flags))
+                            if (record.index && ImGui::BeginTable("Record", 2, flags))
                             {
-                                for (int col=0; col<cols; col++) {
-                                    const char *column_name = result[col];
-                                    const char *value = result[record_index*cols+col];
-                                    
+                                for (int col=0; col<(int)record.values.size(); col++) {
+                                    const char *column_name = records.columns[col].c_str();
+
                                     ImGui::TableNextRow();
                                     
                                     ImGui::TableSetColumnIndex(0);
@@ -508,16 +1333,93 @@ int main(int argc, char**argv)
 
                                     ImGui::TableSetColumnIndex(1);
                                     ImGui::AlignTextToFramePadding();
-                                    ImGui::TextUnformatted(value);
+                                    if (record.nulls[col]) {
+                                        ImGui::TextDisabled("<NULL>");
+                                    }else{
+                                        ImGui::TextUnformatted(record.values[col].c_str());
+                                    }
                                 }
                                 ImGui::EndTable();
                             }
-
-                            sqlite3_free_table(result);
                         }
                     }
 
 
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("Import")) {
+                    DisplayImport(importer, &pool, open_options.readonly);
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("Profiler")) {
+
+                    QueryWorker *worker = query_tabs[current_query]->worker.get();
+                    std::vector<QueryProfile> profiles = worker->Profiler().Recent();
+                    int run = worker->CurrentRun();
+                    std::vector<const QueryProfile*> current, recent;
+                    for (size_t i=0; i<profiles.size(); i++) {
+                        (profiles[i].run == run ? current : recent).push_back(&profiles[i]);
+                    }
+
+                    ImGui::Text("Current query (%s)", query_tabs[current_query]->name.c_str());
+                    if (worker->IsBusy()) {
+                        ImGui::BulletText("Running... %.1f sec, %lld steps",
+                            worker->ElapsedSeconds(),
+                            worker->Steps());
+                    }
+                    DisplayProfiles("Current", current);
+
+                    ImGui::Spacing();
+                    ImGui::Text("Recent queries");
+                    if (ImGui::SmallButton("Clear")) {
+                        worker->Profiler().Clear();
+                    }
+                    DisplayProfiles("Recent", recent);
+
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("Diagnostics")) {
+
+                    ImGui::Checkbox("Show frame times", &show_frame_times);
+                    ImGui::Spacing();
+
+                    ImGui::Text("Connections");
+                    ImGui::BulletText("Journal mode: %s%s",
+                        pool.JournalMode().c_str(),
+                        pool.IsWal() ? "" : " (readers and the writer may wait for each other)");
+                    ImGui::BulletText("1 writer, %d readers (%d idle)", pool.Readers(), pool.IdleReaders());
+                    ImGui::Spacing();
+
+                    ImGui::Text("Schema");
+                    ImGui::BulletText("%d tables, read at schema version %d", (int)catalog.Tables().size(), catalog.Version());
+                    ImGui::Spacing();
+
+                    ImGui::Text("Prepared statements");
+                    DisplayStatementCache("Main connection", *statements);
+                    for (size_t i=0; i<query_tabs.size(); i++) {
+                        const QueryWorker *worker = query_tabs[i]->worker.get();
+                        if (worker->Statements()) {
+                            DisplayStatementCache(query_tabs[i]->name.c_str(), *worker->Statements());
+                        }
+                    }
+                    ImGui::Spacing();
+
+                    ImGui::Text("Results");
+                    const ResultSet& contents = tables_contents.Result();
+                    DisplayTextMemory("Tables tab", contents.TextBytes(), contents.TextBytesAllocated());
+                    for (size_t i=0; i<query_tabs.size(); i++) {
+                        size_t used = 0;
+                        size_t allocated = 0;
+                        for (const std::unique_ptr<ResultSet>& result : query_tabs[i]->results) {
+                            used += result->TextBytes();
+                            allocated += result->TextBytesAllocated();
+                        }
+                        DisplayTextMemory(query_tabs[i]->name.c_str(), used, allocated);
+                    }
+
                     ImGui::EndTabItem();
                 }
                 ImGui::EndTabBar();
@@ -526,16 +1428,27 @@ int main(int argc, char**argv)
             ImGui::End();
         }
 
+        if (show_frame_times) {
+            DisplayFrameTimes(frame_timer, &show_frame_times);
+        }
+
         // Rendering
-        ImGui::Render();
-        glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
-        glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        SDL_GL_SwapWindow(window);
+        {
+            FrameTimer::Scope timing(&frame_timer, FramePhase_Render);
+            ImGui::Render();
+            glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
+            glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
+            glClear(GL_COLOR_BUFFER_BIT);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        {
+            FrameTimer::Scope timing(&frame_timer, FramePhase_Swap);
+            SDL_GL_SwapWindow(window);
+        }
+        frame_timer.EndFrame();
     }
 
-    sqlite3_close(db);
+    close_database();
 
     // Cleanup
     ImGui_ImplOpenGL3_Shutdown();
@@ -0,0 +1,435 @@
+#include "predicate.h"
+#include "result_set.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool IsIdentifierChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || (c & 0x80);
+}
+
+static bool IsIdentifierStart(char c)
+{
+    return IsIdentifierChar(c) && !isdigit((unsigned char)c) && c != '$';
+}
+
+// Skip past a quoted string or identifier starting at text[i], which is
+// the opening quote. Returns the index just past the closing quote, or
+// npos if there isn't one. A doubled quote inside is just two strings
+// back to back, which is all the same to us.
+static size_t SkipQuoted(const std::string& text, size_t i)
+{
+    char close = text[i] == '[' ? ']' : text[i];
+    size_t end = text.find(close, i + 1);
+    return end == std::string::npos ? end : end + 1;
+}
+
+// Trim the term, and collapse every run of whitespace outside of quotes
+// into one space, so that terms which only differ in spacing compare equal.
+static std::string NormalizeTerm(const std::string& text, size_t begin, size_t end)
+{
+    std::string term;
+    size_t i = begin;
+    while (i < end) {
+        char c = text[i];
+        if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            size_t next = SkipQuoted(text, i);
+            term.append(text, i, next - i);
+            i = next;
+        }else if (isspace((unsigned char)c)) {
+            while (i < end && isspace((unsigned char)text[i])) i++;
+            if (!term.empty() && i < end) term += ' ';
+        }else{
+            term += c;
+            i++;
+        }
+    }
+    return term;
+}
+
+// Split where into the terms that are and-ed together at the top level.
+// Returns false for anything where that isn't simply a matter of cutting
+// at each "and": an "or" (which binds less tightly), "between x and y",
+// "case ... end", comments, or unbalanced quotes and parentheses.
+static bool SplitTerms(const std::string& where, std::vector<std::string> *terms)
+{
+    size_t start = 0;
+    int depth = 0;
+    size_t i = 0;
+    while (i < where.size()) {
+        char c = where[i];
+        if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            i = SkipQuoted(where, i);
+            if (i == std::string::npos) return false;
+        }else if ((c == '-' && where[i+1] == '-') || (c == '/' && where[i+1] == '*')) {
+            return false;
+        }else if (c == '(') {
+            depth++;
+            i++;
+        }else if (c == ')') {
+            if (--depth < 0) return false;
+            i++;
+        }else if (IsIdentifierStart(c) && (i == 0 || !IsIdentifierChar(where[i-1]))) {
+            size_t end = i;
+            while (end < where.size() && IsIdentifierChar(where[end])) end++;
+            std::string word = where.substr(i, end - i);
+            for (char& w : word) w = tolower((unsigned char)w);
+            if (depth == 0) {
+                if (word == "or" || word == "between" || word == "case") {
+                    return false;
+                }
+                if (word == "and") {
+                    terms->push_back(NormalizeTerm(where, start, i));
+                    start = end;
+                }
+            }
+            i = end;
+        }else{
+            i++;
+        }
+    }
+    if (depth != 0) return false;
+    terms->push_back(NormalizeTerm(where, start, where.size()));
+
+    for (const std::string& term : *terms) {
+        if (term.empty()) return false;
+    }
+    return true;
+}
+
+static void SkipSpace(const std::string& text, size_t *i)
+{
+    while (*i < text.size() && isspace((unsigned char)text[*i])) (*i)++;
+}
+
+// A column name, bare or quoted.
+static bool ParseColumn(const std::string& text, size_t *i, std::string *column)
+{
+    char c = text[*i];
+    if (c == '"' || c == '`' || c == '[') {
+        size_t end = SkipQuoted(text, *i);
+        if (end == std::string::npos) return false;
+        *column = text.substr(*i + 1, end - *i - 2);
+        // a doubled quote inside is more than we want to deal with
+        if (column->find(c == '[' ? ']' : c) != std::string::npos) return false;
+        *i = end;
+        return !column->empty();
+    }
+    if (!IsIdentifierStart(c)) return false;
+    size_t end = *i;
+    while (end < text.size() && IsIdentifierChar(text[end])) end++;
+    *column = text.substr(*i, end - *i);
+    *i = end;
+    return true;
+}
+
+// A 'string literal', with any doubled quotes undone.
+static bool ParseString(const std::string& text, size_t *i, std::string *value)
+{
+    if (text[*i] != '\'') return false;
+    value->clear();
+    size_t j = *i + 1;
+    for (;;) {
+        if (j >= text.size()) return false;
+        if (text[j] == '\'') {
+            if (j + 1 < text.size() && text[j+1] == '\'') {
+                *value += '\'';
+                j += 2;
+                continue;
+            }
+            break;
+        }
+        *value += text[j++];
+    }
+    *i = j + 1;
+    return true;
+}
+
+// A decimal number, as SQLite would read it: an integer if it has no
+// point or exponent and fits in 64 bits, otherwise a real.
+static bool ParseNumber(const std::string& text, size_t *i, PredicateTerm *term)
+{
+    size_t j = *i;
+    if (text[j] == '+' || text[j] == '-') j++;
+    size_t digits = j;
+    while (j < text.size() && isdigit((unsigned char)text[j])) j++;
+    bool is_integer = true;
+    if (j < text.size() && text[j] == '.') {
+        is_integer = false;
+        j++;
+        while (j < text.size() && isdigit((unsigned char)text[j])) j++;
+    }
+    if (j == digits || (j == digits + 1 && text[digits] == '.')) return false;
+    if (j < text.size() && (text[j] == 'e' || text[j] == 'E')) {
+        is_integer = false;
+        j++;
+        if (j < text.size() && (text[j] == '+' || text[j] == '-')) j++;
+        size_t exponent = j;
+        while (j < text.size() && isdigit((unsigned char)text[j])) j++;
+        if (j == exponent) return false;
+    }
+    if (j < text.size() && IsIdentifierChar(text[j])) return false;
+
+    std::string number = text.substr(*i, j - *i);
+    term->number = strtod(number.c_str(), NULL);
+    if (is_integer) {
+        errno = 0;
+        term->integer = strtoll(number.c_str(), NULL, 10);
+        is_integer = errno == 0;
+    }
+    term->is_integer = is_integer;
+    *i = j;
+    return true;
+}
+
+static PredicateTerm ParseTerm(const std::string& text)
+{
+    PredicateTerm term;
+    term.text = text;
+
+    PredicateTerm parsed = term;
+    size_t i = 0;
+    if (!ParseColumn(text, &i, &parsed.column)) return term;
+    SkipSpace(text, &i);
+
+    if (text.size() - i > 4 && !sqlite3_strnicmp(text.c_str() + i, "like", 4) && !IsIdentifierChar(text[i+4])) {
+        i += 4;
+        SkipSpace(text, &i);
+        std::string pattern;
+        if (!ParseString(text, &i, &pattern)) return term;
+        // only a plain prefix followed by one '%'
+        if (pattern.empty() || pattern.back() != '%') return term;
+        pattern.pop_back();
+        if (pattern.find_first_of("%_") != std::string::npos) return term;
+        parsed.kind = PredicateTerm::LikePrefix;
+        parsed.prefix = pattern;
+    }else{
+        if (text.compare(i, 2, "<=") == 0) {
+            parsed.op = PredicateTerm::LessEqual;
+            i += 2;
+        }else if (text.compare(i, 2, ">=") == 0) {
+            parsed.op = PredicateTerm::GreaterEqual;
+            i += 2;
+        }else if (text.compare(i, 2, "==") == 0) {
+            parsed.op = PredicateTerm::Equal;
+            i += 2;
+        }else if (text.compare(i, 2, "<>") == 0 || text.compare(i, 2, "<<") == 0 || text.compare(i, 2, ">>") == 0) {
+            return term;
+        }else if (text.compare(i, 1, "<") == 0) {
+            parsed.op = PredicateTerm::Less;
+            i += 1;
+        }else if (text.compare(i, 1, ">") == 0) {
+            parsed.op = PredicateTerm::Greater;
+            i += 1;
+        }else if (text.compare(i, 1, "=") == 0) {
+            parsed.op = PredicateTerm::Equal;
+            i += 1;
+        }else{
+            return term;
+        }
+        SkipSpace(text, &i);
+        if (!ParseNumber(text, &i, &parsed)) return term;
+        parsed.kind = PredicateTerm::Compare;
+    }
+
+    SkipSpace(text, &i);
+    if (i != text.size()) return term;
+    return parsed;
+}
+
+std::vector<PredicateTerm> ParsePredicate(const std::string& where)
+{
+    std::vector<PredicateTerm> terms;
+    std::string trimmed = NormalizeTerm(where, 0, where.size());
+    if (trimmed.empty()) return terms;
+
+    std::vector<std::string> texts;
+    if (!SplitTerms(trimmed, &texts)) {
+        // all or nothing
+        PredicateTerm term;
+        term.text = trimmed;
+        terms.push_back(term);
+        return terms;
+    }
+    for (const std::string& text : texts) {
+        terms.push_back(ParseTerm(text));
+    }
+    return terms;
+}
+
+// <0, 0 or >0 as a's number is less than, equal to, or greater than b's.
+static int CompareNumbers(const PredicateTerm& a, const PredicateTerm& b)
+{
+    if (a.is_integer && b.is_integer) {
+        return a.integer < b.integer ? -1 : a.integer > b.integer;
+    }
+    if (a.is_integer) return CompareIntegerReal(a.integer, b.number);
+    if (b.is_integer) return -CompareIntegerReal(b.integer, a.number);
+    return a.number < b.number ? -1 : a.number > b.number;
+}
+
+// Does every row matching narrow match wide too? Text values in a numeric
+// column sort after every number, and NULLs match no comparison, so the
+// comparisons below hold for those too.
+static bool Implies(const PredicateTerm& narrow, const PredicateTerm& wide)
+{
+    if (narrow.text == wide.text) return true;
+    if (narrow.kind != wide.kind || narrow.kind == PredicateTerm::Other) return false;
+    if (sqlite3_stricmp(narrow.column.c_str(), wide.column.c_str())) return false;
+
+    if (narrow.kind == PredicateTerm::LikePrefix) {
+        // like ignores the case of ASCII letters, and so does sqlite3_strnicmp()
+        return narrow.prefix.size() >= wide.prefix.size()
+            && !sqlite3_strnicmp(narrow.prefix.c_str(), wide.prefix.c_str(), (int)wide.prefix.size());
+    }
+
+    // narrow bounds the column from below, from above, or both for "="
+    bool from_below = narrow.op != PredicateTerm::Less && narrow.op != PredicateTerm::LessEqual;
+    bool from_above = narrow.op != PredicateTerm::Greater && narrow.op != PredicateTerm::GreaterEqual;
+    int c = CompareNumbers(narrow, wide);
+    switch (wide.op) {
+    case PredicateTerm::Greater:
+        return from_below && (narrow.op == PredicateTerm::Greater ? c >= 0 : c > 0);
+    case PredicateTerm::GreaterEqual:
+        return from_below && c >= 0;
+    case PredicateTerm::Less:
+        return from_above && (narrow.op == PredicateTerm::Less ? c <= 0 : c < 0);
+    case PredicateTerm::LessEqual:
+        return from_above && c <= 0;
+    case PredicateTerm::Equal:
+        return narrow.op == PredicateTerm::Equal && c == 0;
+    }
+    return false;
+}
+
+bool PredicateNarrows(const std::vector<PredicateTerm>& narrow, const std::vector<PredicateTerm>& wide)
+{
+    for (const PredicateTerm& w : wide) {
+        bool implied = false;
+        for (const PredicateTerm& n : narrow) {
+            if (Implies(n, w)) {
+                implied = true;
+                break;
+            }
+        }
+        if (!implied) return false;
+    }
+    return true;
+}
+
+// The one column of rows with this name, or -1.
+static int FindColumn(const ResultSet& rows, const std::string& name)
+{
+    int found = -1;
+    for (int col=0; col<rows.Columns(); col++) {
+        if (!sqlite3_stricmp(rows.ColumnName(col), name.c_str())) {
+            if (found >= 0) return -1;
+            found = col;
+        }
+    }
+    return found;
+}
+
+// Whether a column declared with this type has INTEGER, REAL or NUMERIC
+// affinity, by SQLite's rules. Only then is it compared with a number as a
+// number: with TEXT affinity the number would be compared as text instead.
+static bool HasNumericAffinity(const std::string& declared_type)
+{
+    std::string type = declared_type;
+    for (char& c : type) c = toupper((unsigned char)c);
+    if (type.find("INT") != std::string::npos) return true;
+    if (type.find("CHAR") != std::string::npos || type.find("CLOB") != std::string::npos ||
+        type.find("TEXT") != std::string::npos) return false;
+    if (type.empty() || type.find("BLOB") != std::string::npos) return false;
+    return true;
+}
+
+// The kernels work down one column at a time, clearing keep for each row
+// that doesn't match. Rows that were already dropped are skipped.
+
+static bool KeepLikePrefix(const ResultSet& rows, int col, const std::string& prefix, std::vector<unsigned char> *keep)
+{
+    // like compares the text of any value, numbers included
+    char buf[64];
+    int length = (int)prefix.size();
+    for (int row=0; row<rows.Rows(); row++) {
+        if (!(*keep)[row]) continue;
+        // whether a blob is like a pattern has changed between SQLite versions
+        if (rows.Type(row, col) == SQLITE_BLOB) return false;
+        const char *text = rows.FormatCell(row, col, buf, sizeof(buf));
+        (*keep)[row] = text && !sqlite3_strnicmp(text, prefix.c_str(), length);
+    }
+    return true;
+}
+
+static void KeepCompare(const ResultSet& rows, int col, const PredicateTerm& term, std::vector<unsigned char> *keep)
+{
+    for (int row=0; row<rows.Rows(); row++) {
+        if (!(*keep)[row]) continue;
+        int c;
+        switch (rows.Type(row, col)) {
+        case SQLITE_NULL:
+            (*keep)[row] = 0;
+            continue;
+        case SQLITE_INTEGER:
+            if (term.is_integer) {
+                sqlite3_int64 value = rows.GetInt64(row, col);
+                c = value < term.integer ? -1 : value > term.integer;
+            }else{
+                c = CompareIntegerReal(rows.GetInt64(row, col), term.number);
+            }
+            break;
+        case SQLITE_FLOAT: {
+            double value = rows.GetDouble(row, col);
+            if (term.is_integer) {
+                c = -CompareIntegerReal(term.integer, value);
+            }else{
+                c = value < term.number ? -1 : value > term.number;
+            }
+            break;
+        }
+        default:
+            // text and blobs come after every number
+            c = 1;
+            break;
+        }
+        switch (term.op) {
+        case PredicateTerm::Less:         (*keep)[row] = c < 0; break;
+        case PredicateTerm::LessEqual:    (*keep)[row] = c <= 0; break;
+        case PredicateTerm::Greater:      (*keep)[row] = c > 0; break;
+        case PredicateTerm::GreaterEqual: (*keep)[row] = c >= 0; break;
+        case PredicateTerm::Equal:        (*keep)[row] = c == 0; break;
+        }
+    }
+}
+
+bool EvaluatePredicate(const std::vector<PredicateTerm>& terms, const std::vector<PredicateTerm>& known,
+    const ResultSet& rows, std::vector<unsigned char> *keep)
+{
+    keep->assign(rows.Rows(), 1);
+    for (const PredicateTerm& term : terms) {
+        bool is_known = false;
+        for (const PredicateTerm& k : known) {
+            if (k.text == term.text) {
+                is_known = true;
+                break;
+            }
+        }
+        if (is_known) continue;
+
+        if (term.kind == PredicateTerm::Other) return false;
+        int col = FindColumn(rows, term.column);
+        if (col < 0) return false;
+
+        if (term.kind == PredicateTerm::LikePrefix) {
+            if (!KeepLikePrefix(rows, col, term.prefix, keep)) return false;
+        }else{
+            if (!HasNumericAffinity(rows.ColumnDeclaredType(col))) return false;
+            KeepCompare(rows, col, term, keep);
+        }
+    }
+    return true;
+}
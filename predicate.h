@@ -0,0 +1,60 @@
+// Predicate - a filter's where clause, as far as we can follow it ourselves.
+//
+// When the user narrows the Tables tab's filter, say from name like 'A%'
+// to name like 'Al%', the new rows are a subset of the ones we already
+// have. If we can show that, the new filter is applied to those rows right
+// here instead of scanning the whole table again.
+//
+// A where clause is split into the terms that are and-ed together. Two
+// kinds of term are understood: column like 'prefix%', and a comparison of
+// a column with a number. Anything else is kept as text, which only ever
+// matches the same text. Whenever it's not certain that we'd get the same
+// rows as SQLite, the answer is "don't know", and the query is run instead.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+class ResultSet;
+
+struct PredicateTerm
+{
+    enum Kind
+    {
+        Other,       // anything we don't follow
+        LikePrefix,  // column like 'prefix%'
+        Compare,     // column <op> number
+    };
+    enum Op
+    {
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+    };
+
+    Kind kind = Other;
+    std::string text;    // the term itself, with whitespace runs collapsed
+    std::string column;  // LikePrefix, Compare: the column name, unquoted
+    std::string prefix;  // LikePrefix: the pattern, without the final '%'
+    Op op = Equal;       // Compare
+    bool is_integer = false;
+    sqlite3_int64 integer = 0;  // Compare: the number, if it is an integer
+    double number = 0;          // Compare: the number
+};
+
+// Split a where clause into its and-ed terms. An empty clause has none.
+std::vector<PredicateTerm> ParsePredicate(const std::string& where);
+
+// True if every row that matches all of the narrow terms is sure to match
+// all of the wide terms too.
+bool PredicateNarrows(const std::vector<PredicateTerm>& narrow, const std::vector<PredicateTerm>& wide);
+
+// Work out which of rows match terms, where rows are known to match the
+// known terms already. keep gets one entry per displayed row, non-zero for
+// a match. Returns false if some term can't be evaluated here.
+bool EvaluatePredicate(const std::vector<PredicateTerm>& terms, const std::vector<PredicateTerm>& known,
+    const ResultSet& rows, std::vector<unsigned char> *keep);
@@ -0,0 +1,84 @@
+#include "query_plan.h"
+#include "statement_cache.h"
+
+#include <stdio.h>
+#include <map>
+
+void QueryPlan::Clear()
+{
+    sql.clear();
+    error.clear();
+    nodes.clear();
+    roots.clear();
+}
+
+bool QueryPlan::Load(StatementCache *statements, const std::string& sql)
+{
+    Clear();
+    this->sql = sql;
+
+    std::string query = "explain query plan " + sql;
+    int rc;
+    sqlite3_stmt *stmt = statements->Acquire(query.c_str(), NULL, &rc);
+    if (stmt == NULL) {
+        error = rc == SQLITE_OK ? "Nothing to explain" : sqlite3_errmsg(statements->Database());
+        return false;
+    }
+
+    // columns are: id, parent, notused, detail
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        PlanNode node;
+        node.id = sqlite3_column_int(stmt, 0);
+        node.parent = sqlite3_column_int(stmt, 1);
+        const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+        node.detail = detail ? detail : "";
+        nodes.push_back(node);
+    }
+    if (rc != SQLITE_DONE) {
+        error = sqlite3_errmsg(statements->Database());
+        fprintf(stderr, "SQL error: %s\n", error.c_str());
+        nodes.clear();
+    }
+    statements->Release(stmt);
+
+    // parents always come before their children
+    std::map<int, int> by_id;
+    for (int i=0; i<(int)nodes.size(); i++) {
+        std::map<int, int>::iterator parent = by_id.find(nodes[i].parent);
+        if (parent == by_id.end()) {
+            roots.push_back(i);
+        }else{
+            nodes[parent->second].children.push_back(i);
+        }
+        by_id[nodes[i].id] = i;
+    }
+    return error.empty();
+}
+
+void QueryPlan::Annotate(const std::vector<ScanStatus>& scans)
+{
+    std::map<std::string, int> lines_with_detail;
+    for (size_t i=0; i<nodes.size(); i++) {
+        nodes[i].has_scan = false;
+        lines_with_detail[nodes[i].detail]++;
+    }
+    for (size_t i=0; i<nodes.size(); i++) {
+        nodes[i].same_detail = lines_with_detail[nodes[i].detail] > 1;
+    }
+
+    // both list the loops in the order they appear in the program, so the
+    // first loop with some text goes to the first line with it, and so on
+    for (size_t s=0; s<scans.size(); s++) {
+        const ScanStatus& scan = scans[s];
+        PlanNode *match = NULL;
+        for (size_t i=0; i<nodes.size() && !match; i++) {
+            if (!nodes[i].has_scan && nodes[i].detail == scan.detail) match = &nodes[i];
+        }
+        if (!match) continue;
+
+        match->has_scan = true;
+        match->loops = scan.loops;
+        match->rows = scan.rows;
+        match->estimated_rows = scan.estimated_rows;
+    }
+}
@@ -0,0 +1,56 @@
+// QueryPlan - the output of EXPLAIN QUERY PLAN, as a tree.
+//
+// Each line of the plan names its parent, so the lines are gathered into
+// a tree for the Plan view of the SQL tab. If the statement ran with scan
+// status enabled, its actual loop counts are matched up with the lines of
+// the plan, to compare against what the planner expected.
+//
+// The loops are matched to lines by their text alone. Nothing else ties
+// them together: the ids in the plan are addresses in the program of the
+// EXPLAIN statement, which has more lines than the one that ran. Where
+// several lines have the same text, as in a self-join without aliases or
+// a repeated subquery, they take the loops with that text in order.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "result_set.h"
+
+class StatementCache;
+
+struct PlanNode
+{
+    int id = 0;
+    int parent = 0;
+    std::string detail;
+    std::vector<int> children;  // indexes into QueryPlan::nodes
+
+    // from sqlite3_stmt_scanstatus(), if known
+    bool has_scan = false;
+    bool same_detail = false;  // other lines have this text, so the match may be wrong
+    sqlite3_int64 loops = 0;
+    sqlite3_int64 rows = 0;
+    double estimated_rows = 0;
+};
+
+class QueryPlan
+{
+public:
+    // Run EXPLAIN QUERY PLAN for the statement.
+    // Returns false (see error) if it could not be explained.
+    bool Load(StatementCache *statements, const std::string& sql);
+
+    // Attach the actual loop counts of a run of the same statement,
+    // matching them to lines by their text.
+    void Annotate(const std::vector<ScanStatus>& scans);
+
+    void Clear();
+
+    std::string sql;
+    std::string error;
+    std::vector<PlanNode> nodes;
+    std::vector<int> roots;  // indexes into nodes
+};
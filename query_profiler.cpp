@@ -0,0 +1,71 @@
+#include "query_profiler.h"
+#include "statement_cache.h"
+
+#include <algorithm>
+
+QueryProfiler::QueryProfiler(size_t history)
+: history(history)
+, run(0)
+{
+}
+
+void QueryProfiler::Attach(sqlite3 *db, const StatementCache *statements)
+{
+    if (statements) caches.push_back(statements);
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, Trace, this);
+}
+
+void QueryProfiler::Detach(sqlite3 *db, const StatementCache *statements)
+{
+    sqlite3_trace_v2(db, 0, NULL, NULL);
+    caches.erase(std::remove(caches.begin(), caches.end(), statements), caches.end());
+}
+
+void QueryProfiler::SetRun(int run)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->run = run;
+}
+
+std::vector<QueryProfile> QueryProfiler::Recent() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<QueryProfile>(profiles.begin(), profiles.end());
+}
+
+void QueryProfiler::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    profiles.clear();
+}
+
+int QueryProfiler::Trace(unsigned type, void *data, void *p, void *x)
+{
+    QueryProfiler *profiler = (QueryProfiler *)data;
+    sqlite3_stmt *stmt = (sqlite3_stmt *)p;
+    if (type != SQLITE_TRACE_PROFILE) return 0;
+    for (size_t i=0; i<profiler->caches.size(); i++) {
+        if (profiler->caches[i]->IsInternal(stmt)) return 0;
+    }
+
+    QueryProfile profile;
+    const char *sql = sqlite3_sql(stmt);
+    profile.sql = sql ? sql : "";
+    profile.seconds = *(sqlite3_int64 *)x / 1e9;
+    profile.fullscan_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+    profile.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0);
+    profile.autoindexes = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+    profile.vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+    int current = 0, highwater = 0;
+    if (sqlite3_db_status(sqlite3_db_handle(stmt), SQLITE_DBSTATUS_CACHE_USED, &current, &highwater, 0) == SQLITE_OK) {
+        profile.cache_bytes = current;
+    }
+
+    std::lock_guard<std::mutex> lock(profiler->mutex);
+    profile.run = profiler->run;
+    profiler->profiles.push_back(profile);
+    while (profiler->profiles.size() > profiler->history) {
+        profiler->profiles.pop_front();
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+// QueryProfiler - records what each statement cost, as it finishes.
+//
+// The profiler hooks a connection with sqlite3_trace_v2(SQLITE_TRACE_PROFILE),
+// which tells us the wall time of every statement that runs on it. Along
+// with that we take the statement's own counters from sqlite3_stmt_status(),
+// and the page cache size of the connection, so the Profiler tab can show
+// why a query was slow: a full table scan, a sort, an automatic index...
+//
+// The callback runs on whichever thread runs the statement; the history is
+// guarded by a mutex so that the UI can read it at any time.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+class StatementCache;
+
+// The cost of one statement.
+struct QueryProfile
+{
+    int run = 0;                    // which run of the worker it belongs to
+    std::string sql;
+    double seconds = 0;             // wall time, as measured by SQLite
+    int fullscan_steps = 0;         // SQLITE_STMTSTATUS_FULLSCAN_STEP
+    int sorts = 0;                  // SQLITE_STMTSTATUS_SORT
+    int autoindexes = 0;            // SQLITE_STMTSTATUS_AUTOINDEX
+    int vm_steps = 0;               // SQLITE_STMTSTATUS_VM_STEP
+    sqlite3_int64 cache_bytes = 0;  // SQLITE_DBSTATUS_CACHE_USED afterwards
+};
+
+class QueryProfiler
+{
+public:
+    QueryProfiler(size_t history);
+
+    // Start profiling the statements run on db. Statements the cache runs
+    // for its own bookkeeping are left out. A profiler may be attached to
+    // several connections, as long as they are all used from one thread.
+    void Attach(sqlite3 *db, const StatementCache *statements);
+    void Detach(sqlite3 *db, const StatementCache *statements);
+
+    // Tag the profiles that follow as belonging to this run.
+    void SetRun(int run);
+
+    // A copy of the recent profiles, oldest first.
+    std::vector<QueryProfile> Recent() const;
+
+    void Clear();
+
+private:
+    QueryProfiler(const QueryProfiler&);
+    QueryProfiler& operator=(const QueryProfiler&);
+
+    static int Trace(unsigned type, void *data, void *p, void *x);
+
+    std::vector<const StatementCache *> caches;
+    size_t history;
+
+    mutable std::mutex mutex;
+    int run;
+    std::deque<QueryProfile> profiles;
+};
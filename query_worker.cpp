@@ -0,0 +1,316 @@
+#include "query_worker.h"
+
+#include <stdio.h>
+#include <chrono>
+
+// How often the progress handler is called, in virtual machine instructions.
+static const int progress_interval = 10000;
+
+// How many prepared statements the worker keeps around for reuse.
+static const int statement_cache_size = 64;
+
+// How many statement profiles the worker keeps.
+static const int profile_history = 100;
+
+// How long to wait for the writer connection at a time, before checking
+// whether the query has been cancelled.
+static const double writer_wait_seconds = 0.050;
+
+// How many rows the worker fetches before handing them over to the UI.
+static const int fetch_rows_per_chunk = 10000;
+static const double fetch_seconds_per_chunk = 0.050;
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QueryWorker::QueryWorker()
+: pool(NULL)
+, db(NULL)
+, read_only(false)
+, profiler(profile_history)
+, quit(false)
+, active(NULL)
+, request_id(0)
+, running_id(0)
+, busy(false)
+, cancelled(false)
+, changed(false)
+, reset(false)
+, start_time(0)
+, end_time(0)
+, steps(0)
+{
+}
+
+QueryWorker::~QueryWorker()
+{
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+            if (active) sqlite3_interrupt(active);
+        }
+        wake.notify_one();
+        thread.join();
+    }
+    incoming.clear();
+    if (db) {
+        // the connection goes back to the pool clean
+        profiler.Detach(db, statements.get());
+        statements.reset();
+        sqlite3_progress_handler(db, 0, NULL, NULL);
+        pool->ReleaseReader(db);
+    }
+}
+
+bool QueryWorker::Open(ConnectionPool *pool, bool read_only)
+{
+    this->pool = pool;
+    this->read_only = read_only;
+    db = pool->AcquireReader();
+    if (!db) {
+        open_error = "No reader connection";
+        return false;
+    }
+    active = db;
+
+    sqlite3_progress_handler(db, progress_interval, ProgressHandler, this);
+    statements.reset(new StatementCache(db, statement_cache_size));
+    profiler.Attach(db, statements.get());
+
+    thread = std::thread(&QueryWorker::Loop, this);
+    return true;
+}
+
+int QueryWorker::ProgressHandler(void *data)
+{
+    QueryWorker *worker = (QueryWorker *)data;
+    worker->steps += progress_interval;
+    return 0;
+}
+
+void QueryWorker::Run(std::string sql)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request = std::move(sql);
+        request_id++;
+        busy = true;
+        cancelled = false;
+        changed = false;
+        reset = true;
+        incoming.clear();
+        start_time = Now();
+        steps = 0;
+        // stop whatever is running now, the worker will pick up the new request
+        if (active) sqlite3_interrupt(active);
+    }
+    wake.notify_one();
+}
+
+void QueryWorker::Cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy) {
+        // stops a query that is still waiting for the writer, too
+        cancelled = true;
+        if (active) sqlite3_interrupt(active);
+    }
+}
+
+int QueryWorker::CurrentRun() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return request_id;
+}
+
+bool QueryWorker::IsBusy() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return busy;
+}
+
+double QueryWorker::ElapsedSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (busy ? Now() : end_time) - start_time;
+}
+
+bool QueryWorker::Poll(std::vector<std::unique_ptr<ResultSet> > *results)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!changed) return false;
+    if (reset) {
+        results->clear();
+        reset = false;
+    }
+    for (size_t i=0; i<incoming.size(); i++) {
+        if (i == results->size()) {
+            results->push_back(std::unique_ptr<ResultSet>(new ResultSet));
+        }
+        incoming[i]->MoveRowsTo((*results)[i].get());
+    }
+    changed = false;
+    return true;
+}
+
+StatementCache *QueryWorker::LockWriter(int id)
+{
+    sqlite3 *writer;
+    while ((writer = pool->LockWriter(writer_wait_seconds)) == NULL) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (request_id != id || cancelled || quit) return NULL;
+    }
+
+    StatementCache *cache = pool->WriterStatements();
+    cache->CheckSchema();
+    sqlite3_progress_handler(writer, progress_interval, ProgressHandler, this);
+    profiler.Attach(writer, cache);
+    std::lock_guard<std::mutex> lock(mutex);
+    active = writer;
+    return cache;
+}
+
+void QueryWorker::UnlockWriter(StatementCache *cache)
+{
+    sqlite3 *writer = cache->Database();
+    {
+        // never interrupt the writer once someone else may have it
+        std::lock_guard<std::mutex> lock(mutex);
+        active = db;
+    }
+    profiler.Detach(writer, cache);
+    sqlite3_progress_handler(writer, 0, NULL, NULL);
+    pool->UnlockWriter();
+}
+
+void QueryWorker::RunScript(int id, StatementCache *cache, const char *tail, std::unique_ptr<ResultSet> first)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+
+    // one statement at a time, each with its own result
+    bool ok = true;
+    bool stopped = false;
+    std::string unrun;  // a statement that was prepared when we stopped
+    while (ok && (*tail || first)) {
+        // an interrupt only stops a statement that is running, so a cancel
+        // that came between two statements is caught here
+        lock.lock();
+        stopped = request_id != id || cancelled || quit;
+        lock.unlock();
+        if (stopped) {
+            if (first) unrun = first->Sql();
+            break;
+        }
+
+        std::unique_ptr<ResultSet> result;
+        if (first) {
+            result = std::move(first);
+            ok = !result->HasError();
+        }else{
+            result.reset(new ResultSet);
+            ok = result->Prepare(cache, tail, &tail);
+        }
+        if (ok && result->IsDone()) {
+            // nothing left but whitespace and comments
+            continue;
+        }
+
+        lock.lock();
+        if (request_id != id || cancelled || quit) {
+            lock.unlock();
+            stopped = true;
+            unrun = result->Sql();
+            break;
+        }
+        size_t index = incoming.size();
+        incoming.push_back(std::unique_ptr<ResultSet>(new ResultSet));
+        for (;;) {
+            result->MoveRowsTo(incoming[index].get());
+            changed = true;
+            if (!ok || result->IsDone()) {
+                ok = ok && !result->HasError();
+                break;
+            }
+
+            lock.unlock();
+            result->Fetch(fetch_rows_per_chunk, fetch_seconds_per_chunk);
+            lock.lock();
+            if (request_id != id || quit) {
+                // superseded, the rows are simply dropped along with result
+                ok = false;
+                break;
+            }
+            if (cancelled) {
+                // hand over the rows fetched so far, and stop
+                ok = false;
+                stopped = true;
+            }
+        }
+        lock.unlock();
+    }
+
+    // the rest of a cancelled script is listed, but not run
+    lock.lock();
+    if (stopped && cancelled && request_id == id && !quit) {
+        SkipStatements(unrun.c_str());
+        SkipStatements(tail);
+    }
+    lock.unlock();
+}
+
+void QueryWorker::SkipStatements(const char *sql)
+{
+    while (*sql) {
+        std::unique_ptr<ResultSet> skipped(new ResultSet);
+        skipped->Skip(sql, &sql, "Not run: the script was cancelled");
+        if (skipped->Sql().empty()) break;
+        incoming.push_back(std::move(skipped));
+        changed = true;
+    }
+}
+
+void QueryWorker::Loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this]{ return quit || running_id != request_id; });
+        if (quit) break;
+
+        int id = running_id = request_id;
+        std::string sql = std::move(request);
+        lock.unlock();
+        profiler.SetRun(id);
+
+        // A lone statement that only reads runs on our own reader, alongside
+        // whatever else is running. Anything else might write, so it waits
+        // its turn for the writer connection.
+        const char *tail = sql.c_str();
+        statements->CheckSchema();
+        std::unique_ptr<ResultSet> first(new ResultSet);
+        bool ok = first->Prepare(statements.get(), tail, &tail);
+        if (ok && first->IsDone()) {
+            // nothing to run
+        }else if (read_only) {
+            RunScript(id, statements.get(), "", std::move(first));
+        }else if (ok && *tail == '\0' && first->ReadOnly() && first->Columns() > 0) {
+            RunScript(id, statements.get(), tail, std::move(first));
+        }else{
+            first.reset();
+            StatementCache *writer = LockWriter(id);
+            if (writer) {
+                RunScript(id, writer, sql.c_str(), std::unique_ptr<ResultSet>());
+                UnlockWriter(writer);
+            }
+        }
+
+        lock.lock();
+        if (request_id == id) {
+            busy = false;
+            changed = true;
+            end_time = Now();
+        }
+    }
+}
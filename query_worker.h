@@ -0,0 +1,110 @@
+// QueryWorker - runs SQL queries on a background thread.
+//
+// The worker has its own reader connection from the pool, so a long query
+// doesn't stop the UI from drawing, or from browsing on its own reader.
+// Anything that might write takes its turn on the pool's writer connection.
+// Rows are streamed in chunks and handed over to the UI via Poll().
+//
+// A query may be a script of several statements. They run one after the
+// other, each producing its own ResultSet, until one of them fails. If the
+// script is cancelled, the statements it didn't get to have a ResultSet
+// each too, marked as not run.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sqlite3.h>
+
+#include "connection_pool.h"
+#include "query_profiler.h"
+#include "result_set.h"
+#include "statement_cache.h"
+
+class QueryWorker
+{
+public:
+    QueryWorker();
+    ~QueryWorker();
+
+    // Take a reader connection from the pool and start the worker's thread.
+    // Returns false (see Error()) if there was no connection to be had.
+    // The pool must outlive the worker. A read_only worker never takes the
+    // writer: it runs only the first statement of a query, on its reader,
+    // where anything that tries to write fails.
+    bool Open(ConnectionPool *pool, bool read_only = false);
+
+    // Start running a query, cancelling any query that is still running.
+    void Run(std::string sql);
+
+    // Interrupt the running query, if any. No more of a script is run after
+    // the statement that is running now.
+    void Cancel();
+
+    // Move any rows that have arrived since the last call onto the end of
+    // results, one ResultSet per statement. The first rows of a new query
+    // replace what was there before, so the old results stay visible until
+    // then. Returns true if the results changed.
+    bool Poll(std::vector<std::unique_ptr<ResultSet> > *results);
+
+    bool IsBusy() const;
+    double ElapsedSeconds() const;
+
+    // Number of virtual machine instructions run so far by the current
+    // (or last) script, as counted by the progress handler.
+    long long Steps() const { return steps; }
+
+    const std::string& Error() const { return open_error; }
+
+    // The prepared statements of the worker's reader, for the diagnostics panel.
+    const StatementCache *Statements() const { return statements.get(); }
+
+    // What each statement run by the worker cost, for the Profiler tab.
+    // Profiles of the latest query are tagged with CurrentRun().
+    QueryProfiler& Profiler() { return profiler; }
+    int CurrentRun() const;
+
+private:
+    QueryWorker(const QueryWorker&);
+    QueryWorker& operator=(const QueryWorker&);
+
+    void Loop();
+    void RunScript(int id, StatementCache *cache, const char *tail, std::unique_ptr<ResultSet> first);
+    // Add a result for each statement in sql, marked as not run. Call with
+    // the mutex held.
+    void SkipStatements(const char *sql);
+    StatementCache *LockWriter(int id);
+    void UnlockWriter(StatementCache *cache);
+    static int ProgressHandler(void *data);
+
+    ConnectionPool *pool;
+    sqlite3 *db;  // our reader
+    bool read_only;
+    std::unique_ptr<StatementCache> statements;
+    QueryProfiler profiler;
+    std::string open_error;
+    std::thread thread;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool quit;
+    sqlite3 *active;  // the connection to interrupt, guarded by mutex
+
+    // guarded by mutex
+    std::string request;
+    int request_id;
+    int running_id;
+    bool busy;
+    bool cancelled;
+    bool changed;
+    bool reset;
+    std::vector<std::unique_ptr<ResultSet> > incoming;
+    double start_time;
+    double end_time;
+
+    std::atomic<long long> steps;
+};
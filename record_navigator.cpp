@@ -0,0 +1,157 @@
+#include "record_navigator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void RecordNavigator::Close()
+{
+    sqlite3_finalize(by_offset);
+    sqlite3_finalize(after_rowid);
+    sqlite3_finalize(before_rowid);
+    by_offset = after_rowid = before_rowid = NULL;
+    has_rowid = false;
+    count = 0;
+    columns.clear();
+    error.clear();
+    prev = current = next = Record();
+    valid = false;
+}
+
+bool RecordNavigator::Open(sqlite3 *db, const char *new_table, const char *new_where, const DatabaseVersion& new_version)
+{
+    if (valid && version == new_version && table == new_table && where == new_where) {
+        return false;
+    }
+
+    Close();
+    table = new_table;
+    where = new_where;
+    version = new_version;
+    valid = true;
+
+    std::string from = " from " + QuoteIdentifier(table) + " where (" + where + "\n)";
+
+    // views don't have a usable rowid, and for WITHOUT ROWID tables
+    // the statements below fail to prepare
+    has_rowid = false;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, "select type from sqlite_master where name = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            has_rowid = strcmp((const char *)sqlite3_column_text(stmt, 0), "table") == 0;
+        }
+    }
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    if (has_rowid) {
+        has_rowid =
+            sqlite3_prepare_v2(db, ("select rowid, *" + from + " order by rowid limit 1 offset ?").c_str(), -1, &by_offset, NULL) == SQLITE_OK &&
+            sqlite3_prepare_v2(db, ("select rowid, *" + from + " and rowid > ? order by rowid limit 1").c_str(), -1, &after_rowid, NULL) == SQLITE_OK &&
+            sqlite3_prepare_v2(db, ("select rowid, *" + from + " and rowid < ? order by rowid desc limit 1").c_str(), -1, &before_rowid, NULL) == SQLITE_OK;
+    }
+    if (!has_rowid) {
+        sqlite3_finalize(by_offset);
+        sqlite3_finalize(after_rowid);
+        sqlite3_finalize(before_rowid);
+        by_offset = after_rowid = before_rowid = NULL;
+        if (sqlite3_prepare_v2(db, ("select *" + from + " limit 1 offset ?").c_str(), -1, &by_offset, NULL) != SQLITE_OK) {
+            error = sqlite3_errmsg(db);
+            fprintf(stderr, "SQL error: %s\n", error.c_str());
+            return true;
+        }
+    }
+
+    int first = has_rowid ? 1 : 0;
+    for (int col=first; col<sqlite3_column_count(by_offset); col++) {
+        columns.push_back(sqlite3_column_name(by_offset, col));
+    }
+
+    if (sqlite3_prepare_v2(db, ("select count(*)" + from).c_str(), -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+    }else{
+        error = sqlite3_errmsg(db);
+        fprintf(stderr, "SQL error: %s\n", error.c_str());
+    }
+    sqlite3_finalize(stmt);
+
+    return true;
+}
+
+int RecordNavigator::Wrap(int index) const
+{
+    if (index < 1) return count;
+    if (index > count) return 1;
+    return index;
+}
+
+bool RecordNavigator::Fetch(sqlite3_stmt *stmt, int index, Record *record)
+{
+    *record = Record();
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        int first = has_rowid ? 1 : 0;
+        int cols = sqlite3_column_count(stmt);
+        record->index = index;
+        record->rowid = has_rowid ? sqlite3_column_int64(stmt, 0) : 0;
+        for (int col=first; col<cols; col++) {
+            bool is_null = sqlite3_column_type(stmt, col) == SQLITE_NULL;
+            const char *text = (const char *)sqlite3_column_text(stmt, col);
+            record->values.push_back(text ? text : "");
+            record->nulls.push_back(is_null);
+        }
+    }else if (rc != SQLITE_DONE) {
+        error = sqlite3_errmsg(sqlite3_db_handle(stmt));
+    }
+    sqlite3_reset(stmt);
+    return record->index != 0;
+}
+
+bool RecordNavigator::FetchAt(int index, Record *record)
+{
+    sqlite3_bind_int(by_offset, 1, index - 1);
+    return Fetch(by_offset, index, record);
+}
+
+void RecordNavigator::FetchNeighbour(int index, sqlite3_stmt *seek, Record *record)
+{
+    bool adjacent = index == current.index + 1 || index == current.index - 1;
+    if (has_rowid && adjacent) {
+        sqlite3_bind_int64(seek, 1, current.rowid);
+        Fetch(seek, index, record);
+    }else{
+        FetchAt(index, record);
+    }
+}
+
+void RecordNavigator::Goto(int index)
+{
+    if (!valid || !error.empty()) return;
+    if (count == 0) {
+        prev = current = next = Record();
+        return;
+    }
+
+    index = Wrap(index);
+    if (current.index == index) return;
+
+    if (next.index == index) {
+        prev = std::move(current);
+        current = std::move(next);
+        next = Record();
+    }else if (prev.index == index) {
+        next = std::move(current);
+        current = std::move(prev);
+        prev = Record();
+    }else{
+        prev = next = Record();
+        FetchAt(index, &current);
+    }
+
+    // prefetch the neighbours, so that Prev/Next won't have to wait
+    if (current.index) {
+        if (!prev.index) FetchNeighbour(Wrap(index - 1), before_rowid, &prev);
+        if (!next.index) FetchNeighbour(Wrap(index + 1), after_rowid, &next);
+    }
+}
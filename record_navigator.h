@@ -0,0 +1,63 @@
+// RecordNavigator - the Records tab's view of one table, one record at a time.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "database.h"
+
+// One row of a table, as shown in the Records tab.
+struct Record
+{
+    int index = 0;  // 1-based position within the (filtered) table, 0 if not loaded
+    sqlite3_int64 rowid = 0;
+    std::vector<std::string> values;
+    std::vector<bool> nulls;
+};
+
+// Steps through the records of one table, optionally filtered, one at a time.
+// Only the current record and its two neighbours are ever held in memory, and
+// the neighbours are fetched ahead of time so that Prev/Next is instant.
+// For ordinary tables we walk in rowid order, so fetching a neighbour is an
+// index seek. Views and WITHOUT ROWID tables fall back to LIMIT 1 OFFSET ?.
+struct RecordNavigator
+{
+    std::string table;
+    std::string where;
+    DatabaseVersion version;
+    bool valid = false;
+    std::string error;
+
+    bool has_rowid = false;
+    int count = 0;
+    std::vector<std::string> columns;
+
+    sqlite3_stmt *by_offset = NULL;
+    sqlite3_stmt *after_rowid = NULL;
+    sqlite3_stmt *before_rowid = NULL;
+
+    Record prev;
+    Record current;
+    Record next;
+
+    ~RecordNavigator() { Close(); }
+
+    void Close();
+
+    // (Re)prepare the statements for this table and filter, unless they are
+    // already prepared against this version of the database.
+    // Returns true if anything changed.
+    bool Open(sqlite3 *db, const char *new_table, const char *new_where, const DatabaseVersion& new_version);
+
+    // Make index (1-based) the current record, fetching it and its neighbours.
+    void Goto(int index);
+
+    int Wrap(int index) const;
+    bool Fetch(sqlite3_stmt *stmt, int index, Record *record);
+    bool FetchAt(int index, Record *record);
+
+    // Fetch the record next to the current one, seeking on rowid when we can.
+    void FetchNeighbour(int index, sqlite3_stmt *seek, Record *record);
+};
@@ -0,0 +1,547 @@
+#include "result_set.h"
+#include "statement_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// Adds the time until it goes out of scope onto a running total.
+struct ScopedTimer
+{
+    double *total;
+    std::chrono::steady_clock::time_point start;
+
+    ScopedTimer(double *total) : total(total), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { *total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+};
+
+}
+
+ResultSet::ResultSet()
+: stmt(NULL)
+, db(NULL)
+, cache(NULL)
+, seconds(0)
+, vm_steps(0)
+, changes(0)
+, rows(0)
+, can_requery(false)
+, read_only(false)
+, not_run(false)
+{
+}
+
+ResultSet::~ResultSet()
+{
+    Clear();
+}
+
+void ResultSet::Clear()
+{
+    ReleaseStatement();
+    error.clear();
+    seconds = 0;
+    vm_steps = 0;
+    changes = 0;
+    scans.clear();
+    rows = 0;
+    columns.clear();
+    strings.Clear();
+    can_requery = false;
+    read_only = false;
+    not_run = false;
+    sql.clear();
+    sort_keys.clear();
+    order.clear();
+}
+
+void ResultSet::MoveRowsTo(ResultSet *dest)
+{
+    if (dest->rows == 0) {
+        dest->columns.resize(columns.size());
+        for (size_t col=0; col<columns.size(); col++) {
+            dest->columns[col].name = columns[col].name;
+            dest->columns[col].declared_type = columns[col].declared_type;
+        }
+        dest->can_requery = can_requery;
+        dest->read_only = read_only;
+    }
+    dest->not_run = not_run;
+    dest->sql = sql;
+    if (!error.empty()) {
+        dest->error = error;
+    }
+    dest->seconds = seconds;
+    dest->vm_steps = vm_steps;
+    dest->changes = changes;
+    if (!scans.empty()) {
+        dest->scans.swap(scans);
+        scans.clear();
+    }
+
+    // the text stays where it is, only the arena chunks change hands
+    dest->strings.TakeFrom(&strings);
+
+    for (size_t col=0; col<columns.size() && col<dest->columns.size(); col++) {
+        Column& from = columns[col];
+        Column& to = dest->columns[col];
+        if (to.values.empty()) {
+            to.types.swap(from.types);
+            to.values.swap(from.values);
+            to.lengths.swap(from.lengths);
+        }else{
+            to.types.insert(to.types.end(), from.types.begin(), from.types.end());
+            to.values.insert(to.values.end(), from.values.begin(), from.values.end());
+            to.lengths.insert(to.lengths.end(), from.lengths.begin(), from.lengths.end());
+        }
+        from.types.clear();
+        from.values.clear();
+        from.lengths.clear();
+    }
+    dest->rows += rows;
+    rows = 0;
+}
+
+const char *ResultSet::FormatCell(int row, int col, char *buf, int size) const
+{
+    switch (Type(row, col)) {
+    case SQLITE_NULL:
+        return NULL;
+    case SQLITE_INTEGER:
+        sqlite3_snprintf(size, buf, "%lld", GetInt64(row, col));
+        return buf;
+    case SQLITE_FLOAT:
+        // the same format SQLite uses to turn a real into text
+        sqlite3_snprintf(size, buf, "%!.15g", GetDouble(row, col));
+        return buf;
+    default:
+        return GetText(row, col);
+    }
+}
+
+// Skip past any whitespace, comments and empty statements,
+// to see whether more SQL follows.
+static const char *SkipWhitespaceAndComments(const char *sql)
+{
+    for (;;) {
+        while (*sql == ' ' || *sql == '\t' || *sql == '\n' || *sql == '\r' || *sql == '\f' || *sql == ';') sql++;
+        if (sql[0] == '-' && sql[1] == '-') {
+            while (*sql && *sql != '\n') sql++;
+        }else if (sql[0] == '/' && sql[1] == '*') {
+            const char *end = strstr(sql + 2, "*/");
+            sql = end ? end + 2 : sql + strlen(sql);
+        }else{
+            return sql;
+        }
+    }
+}
+
+// Does the SQL start with this keyword?
+static bool StartsWithKeyword(const char *sql, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    return sqlite3_strnicmp(sql, keyword, (int)len) == 0 && !isalnum((unsigned char)sql[len]) && sql[len] != '_';
+}
+
+int ResultSet::PrepareStatement(const char *query, const char **tail)
+{
+    if (cache) {
+        int rc;
+        stmt = cache->Acquire(query, tail, &rc);
+        return rc;
+    }
+    return sqlite3_prepare_v2(db, query, -1, &stmt, tail);
+}
+
+void ResultSet::ReleaseStatement()
+{
+    if (cache) {
+        cache->Release(stmt);
+    }else{
+        sqlite3_finalize(stmt);
+    }
+    stmt = NULL;
+}
+
+bool ResultSet::Prepare(sqlite3 *db, const char *query, const char **tail_out)
+{
+    return Prepare(db, NULL, query, tail_out);
+}
+
+bool ResultSet::Prepare(StatementCache *cache, const char *query, const char **tail_out)
+{
+    return Prepare(cache->Database(), cache, query, tail_out);
+}
+
+bool ResultSet::Prepare(sqlite3 *db, StatementCache *cache, const char *query, const char **tail_out)
+{
+    Clear();
+    this->db = db;
+    this->cache = cache;
+    ScopedTimer timer(&seconds);
+
+    bool single_statement = true;
+    const char *tail = SkipWhitespaceAndComments(query);
+    while (*tail) {
+        const char *start = tail;
+        int rc = PrepareStatement(tail, &tail);
+        if (rc != SQLITE_OK) {
+            error = sqlite3_errmsg(db);
+            fprintf(stderr, "SQL error: %s\n", error.c_str());
+            ReleaseStatement();
+            sql = start;
+            if (tail_out) *tail_out = start + strlen(start);
+            return false;
+        }
+        tail = SkipWhitespaceAndComments(tail);
+        if (stmt == NULL) {
+            continue;
+        }
+        if (tail_out) {
+            // just the one statement, the caller takes care of the rest
+            *tail_out = tail;
+            break;
+        }
+        if (*tail == '\0') {
+            break;
+        }
+
+        // more statements follow, so run this one to completion first
+        single_statement = false;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+        if (rc != SQLITE_DONE) {
+            error = sqlite3_errmsg(db);
+            fprintf(stderr, "SQL error: %s\n", error.c_str());
+            ReleaseStatement();
+            return false;
+        }
+        ReleaseStatement();
+    }
+    if (stmt == NULL && tail_out) {
+        *tail_out = tail;
+    }
+
+    if (stmt) {
+        ReadColumns();
+        int cols = Columns();
+
+        const char *text = SkipWhitespaceAndComments(sqlite3_sql(stmt));
+        sql = text;
+        read_only = sqlite3_stmt_readonly(stmt) != 0;
+        can_requery = single_statement
+            && cols > 0
+            && sqlite3_stmt_readonly(stmt)
+            && !sqlite3_stmt_isexplain(stmt)
+            && (StartsWithKeyword(text, "select") || StartsWithKeyword(text, "with") || StartsWithKeyword(text, "values"));
+    }
+    return true;
+}
+
+void ResultSet::Skip(const char *query, const char **tail_out, const std::string& reason)
+{
+    Clear();
+    const char *start = SkipWhitespaceAndComments(query);
+    const char *end = StatementEnd(start);
+    sql.assign(start, end);
+    error = reason;
+    not_run = true;
+    *tail_out = SkipWhitespaceAndComments(end);
+}
+
+void ResultSet::ReadColumns()
+{
+    int cols = sqlite3_column_count(stmt);
+    columns.resize(cols);
+    for (int col=0; col<cols; col++) {
+        columns[col].name = sqlite3_column_name(stmt, col);
+        const char *declared_type = sqlite3_column_decltype(stmt, col);
+        columns[col].declared_type = declared_type ? declared_type : "";
+    }
+}
+
+void ResultSet::Finish(int rc)
+{
+    if (rc != SQLITE_DONE) {
+        error = sqlite3_errmsg(db);
+        fprintf(stderr, "SQL error: %s\n", error.c_str());
+    }else if (!sqlite3_stmt_readonly(stmt)) {
+        changes = sqlite3_changes(db);
+    }
+    vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+#ifdef SQLITE_ENABLE_STMT_SCANSTATUS
+    for (int index=0; ; index++) {
+        ScanStatus scan;
+        const char *detail = NULL;
+        if (sqlite3_stmt_scanstatus(stmt, index, SQLITE_SCANSTAT_NLOOP, &scan.loops)) {
+            break;
+        }
+        sqlite3_stmt_scanstatus(stmt, index, SQLITE_SCANSTAT_NVISIT, &scan.rows);
+        sqlite3_stmt_scanstatus(stmt, index, SQLITE_SCANSTAT_EST, &scan.estimated_rows);
+        sqlite3_stmt_scanstatus(stmt, index, SQLITE_SCANSTAT_EXPLAIN, &detail);
+        scan.detail = detail ? detail : "";
+        scans.push_back(scan);
+    }
+#endif
+    ReleaseStatement();
+}
+
+int ResultSet::Fetch(int max_rows, double max_seconds)
+{
+    if (stmt == NULL) return 0;
+    ScopedTimer timer(&seconds);
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(max_seconds));
+
+    int cols = Columns();
+    int fetched = 0;
+    while (fetched < max_rows) {
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_ROW) {
+            Finish(rc);
+            break;
+        }
+        if (rows == 0 && fetched == 0 && sqlite3_column_count(stmt) != cols) {
+            // A cached statement from before a schema change is prepared
+            // again by its first step, and may have other columns now.
+            ReadColumns();
+            cols = Columns();
+        }
+
+        for (int col=0; col<cols; col++) {
+            Column& column = columns[col];
+            int type = sqlite3_column_type(stmt, col);
+            Value value;
+            value.integer = 0;
+            int length = 0;
+            if (type == SQLITE_INTEGER) {
+                value.integer = sqlite3_column_int64(stmt, col);
+            }else if (type == SQLITE_FLOAT) {
+                value.real = sqlite3_column_double(stmt, col);
+            }else if (type == SQLITE_TEXT || type == SQLITE_BLOB) {
+                const char *bytes = type == SQLITE_TEXT
+                    ? (const char *)sqlite3_column_text(stmt, col)
+                    : (const char *)sqlite3_column_blob(stmt, col);
+                length = sqlite3_column_bytes(stmt, col);
+                value.text = strings.Store(bytes ? bytes : "", length);
+            }
+            column.types.push_back((unsigned char)type);
+            column.values.push_back(value);
+            column.lengths.push_back(length);
+        }
+        rows++;
+        fetched++;
+
+        // checking the clock is cheap, but not free
+        if ((fetched & 255) == 0 && clock::now() > deadline) {
+            break;
+        }
+    }
+    return fetched;
+}
+
+std::string OrderByClause(const std::vector<SortKey>& keys)
+{
+    std::string clause;
+    for (size_t i=0; i<keys.size(); i++) {
+        clause += i==0 ? " order by " : ", ";
+        clause += std::to_string(keys[i].column + 1);
+        if (keys[i].descending) clause += " desc";
+    }
+    return clause;
+}
+
+std::string SortedQuery(const std::string& sql, const std::vector<SortKey>& keys)
+{
+    if (keys.empty()) return sql;
+
+    // drop any trailing semicolons, which can't go inside the parentheses
+    std::string inner = sql;
+    for (;;) {
+        size_t end = inner.find_last_not_of(" \t\r\n\f");
+        if (end == std::string::npos || inner[end] != ';') break;
+        inner.erase(end);
+    }
+    // the newline ends any trailing -- comment
+    return "select * from (\n" + inner + "\n)" + OrderByClause(keys);
+}
+
+// Sorting compares values the way SQLite orders them: NULLs first,
+// then numbers, then text, then blobs. Text and blobs are compared byte by
+// byte, a shorter one first when it is the start of the longer, which is
+// SQLite's BINARY collation.
+namespace {
+
+int TypeOrder(int type)
+{
+    switch (type) {
+    case SQLITE_NULL: return 0;
+    case SQLITE_INTEGER: return 1;
+    case SQLITE_FLOAT: return 1;
+    case SQLITE_TEXT: return 2;
+    default: return 3;
+    }
+}
+
+}
+
+int CompareIntegerReal(sqlite3_int64 i, double r)
+{
+    // converting i to a double would make 2^63-1 equal to 2^63, for one
+    if (r < -9223372036854775808.0) return 1;
+    if (r >= 9223372036854775808.0) return -1;
+    sqlite3_int64 whole = (sqlite3_int64)r;
+    if (i != whole) return i < whole ? -1 : 1;
+    // the same whole part, so only a fraction of r can be left
+    double d = (double)i;
+    return d < r ? -1 : d > r ? 1 : 0;
+}
+
+struct ResultSet::RowLess
+{
+    struct Key
+    {
+        const unsigned char *types;
+        const Value *values;
+        const int *lengths;
+        bool descending;
+    };
+    std::vector<Key> keys;
+
+    int Compare(const Key& key, int a, int b) const
+    {
+        int type_a = key.types[a];
+        int type_b = key.types[b];
+        int c = TypeOrder(type_a) - TypeOrder(type_b);
+        if (c != 0 || type_a == SQLITE_NULL) return c;
+
+        const Value& x = key.values[a];
+        const Value& y = key.values[b];
+        if (type_a == SQLITE_INTEGER && type_b == SQLITE_INTEGER) {
+            return x.integer < y.integer ? -1 : x.integer > y.integer ? 1 : 0;
+        }
+        if (type_a == SQLITE_FLOAT && type_b == SQLITE_FLOAT) {
+            return x.real < y.real ? -1 : x.real > y.real ? 1 : 0;
+        }
+        if (type_a == SQLITE_INTEGER && type_b == SQLITE_FLOAT) return CompareIntegerReal(x.integer, y.real);
+        if (type_a == SQLITE_FLOAT && type_b == SQLITE_INTEGER) return -CompareIntegerReal(y.integer, x.real);
+        int length_a = key.lengths[a];
+        int length_b = key.lengths[b];
+        c = memcmp(x.text, y.text, std::min(length_a, length_b));
+        if (c != 0) return c;
+        return length_a - length_b;
+    }
+
+    bool operator()(int a, int b) const
+    {
+        for (const Key& key : keys) {
+            int c = Compare(key, a, b);
+            if (c != 0) return key.descending ? c > 0 : c < 0;
+        }
+        // keep equal rows in their original order
+        return a < b;
+    }
+};
+
+void ResultSet::KeepRows(const std::vector<unsigned char>& keep)
+{
+    int kept = 0;
+    for (int row=0; row<rows; row++) {
+        if (keep[row]) kept++;
+    }
+
+    for (Column& column : columns) {
+        std::vector<unsigned char> types;
+        std::vector<Value> values;
+        std::vector<int> lengths;
+        types.reserve(kept);
+        values.reserve(kept);
+        lengths.reserve(kept);
+        for (int row=0; row<rows; row++) {
+            if (!keep[row]) continue;
+            int stored = Stored(row);
+            types.push_back(column.types[stored]);
+            values.push_back(column.values[stored]);
+            lengths.push_back(column.lengths[stored]);
+        }
+        column.types.swap(types);
+        column.values.swap(values);
+        column.lengths.swap(lengths);
+    }
+    rows = kept;
+
+    // the rows are stored in sorted order now
+    order.clear();
+    for (int row=0; !sort_keys.empty() && row<rows; row++) {
+        order.push_back(row);
+    }
+}
+
+void ResultSet::Sort(const std::vector<SortKey>& keys)
+{
+    sort_keys = keys;
+    order.clear();
+    if (keys.empty()) return;
+
+    std::vector<int> sorted(rows);
+    for (int row=0; row<rows; row++) {
+        sorted[row] = row;
+    }
+    RowLess less;
+    for (const SortKey& key : keys) {
+        const Column& column = columns[key.column];
+        RowLess::Key k = { column.types.data(), column.values.data(), column.lengths.data(), key.descending };
+        less.keys.push_back(k);
+    }
+
+    // Small results are sorted right here. Bigger ones are cut into one
+    // slice per thread, sorted in parallel, and then merged pairwise.
+    const int min_rows_per_thread = 50000;
+    int threads = (int)std::thread::hardware_concurrency();
+    threads = std::max(1, std::min(threads, rows / min_rows_per_thread));
+    if (threads == 1) {
+        std::sort(sorted.begin(), sorted.end(), less);
+        order.swap(sorted);
+        return;
+    }
+
+    std::vector<int> bounds;
+    for (int t=0; t<=threads; t++) {
+        bounds.push_back((int)((long long)rows * t / threads));
+    }
+
+    std::vector<std::thread> workers;
+    for (int t=0; t<threads; t++) {
+        workers.push_back(std::thread([&, t]{
+            std::sort(sorted.begin() + bounds[t], sorted.begin() + bounds[t+1], less);
+        }));
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    while (bounds.size() > 2) {
+        std::vector<int> merged;
+        workers.clear();
+        for (size_t i=0; i+2<bounds.size(); i+=2) {
+            int first = bounds[i], middle = bounds[i+1], last = bounds[i+2];
+            workers.push_back(std::thread([&, first, middle, last]{
+                std::inplace_merge(sorted.begin() + first, sorted.begin() + middle, sorted.begin() + last, less);
+            }));
+            merged.push_back(first);
+        }
+        if (bounds.size() % 2 == 0) {
+            // odd number of slices, the last one waits for the next round
+            merged.push_back(bounds[bounds.size()-2]);
+        }
+        merged.push_back(bounds.back());
+        for (std::thread& worker : workers) worker.join();
+        bounds = merged;
+    }
+
+    order.swap(sorted);
+}
@@ -0,0 +1,215 @@
+// ResultSet - the rows and columns produced by one SQL query.
+//
+// Rows are streamed from a prepared statement in chunks, so that the first
+// page of a large result can be displayed right away while the rest keeps
+// loading over the following frames.
+//
+// Cells are stored column by column, so a result with hundreds of columns
+// costs nothing extra for the columns that are not on screen. Each cell keeps
+// its SQLite type: integers and reals are stored as numbers and only turned
+// into text when they are drawn, and text is kept in a StringArena.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "string_arena.h"
+
+class StatementCache;
+
+// One column to sort by, as picked by clicking on a column header.
+struct SortKey
+{
+    int column;
+    bool descending;
+
+    bool operator==(const SortKey& other) const { return column == other.column && descending == other.descending; }
+    bool operator!=(const SortKey& other) const { return !(*this == other); }
+};
+
+// An "order by ..." clause for the sort keys, using column numbers,
+// or an empty string if there are no keys.
+std::string OrderByClause(const std::vector<SortKey>& keys);
+
+// Wrap a single select statement so that SQLite sorts its result.
+std::string SortedQuery(const std::string& sql, const std::vector<SortKey>& keys);
+
+// Compare an integer with a real exactly, as SQLite does: -1, 0 or 1.
+int CompareIntegerReal(sqlite3_int64 i, double r);
+
+// How one loop of a query went, from sqlite3_stmt_scanstatus().
+// Only collected when SQLite is built with SQLITE_ENABLE_STMT_SCANSTATUS.
+struct ScanStatus
+{
+    std::string detail;     // the loop's line in EXPLAIN QUERY PLAN
+    sqlite3_int64 loops;    // times the loop was started
+    sqlite3_int64 rows;     // rows visited, over all of those times
+    double estimated_rows;  // the planner's guess, per time
+};
+
+class ResultSet
+{
+public:
+    ResultSet();
+    ~ResultSet();
+
+    // Prepare a query for streaming. If the text holds several statements,
+    // all but the last are run to completion here and only the last one is
+    // streamed. Returns false (see Error()) if the query could not be prepared.
+    // If tail is given, only the first statement is prepared, and *tail is
+    // set to the text after it, for running a script one statement at a time.
+    // If that text holds no statement at all, we end up with IsDone() set.
+    bool Prepare(sqlite3 *db, const char *query, const char **tail = NULL);
+
+    // The same, but reusing statements from the cache where possible.
+    // Statements are given back to the cache instead of being finalized.
+    bool Prepare(StatementCache *cache, const char *query, const char **tail = NULL);
+
+    // Stand in for the first statement in query without running it, as when
+    // a script is cancelled before getting to it: Sql() is its text, and
+    // Error() the reason. *tail is set to the text after it.
+    void Skip(const char *query, const char **tail, const std::string& reason);
+
+    // Fetch more rows, stopping after max_rows rows or max_seconds seconds,
+    // whichever comes first. Returns the number of rows fetched.
+    int Fetch(int max_rows, double max_seconds);
+
+    // Drop all rows and finalize the statement, if any.
+    void Clear();
+
+    // Move the rows fetched so far onto the end of another result, along
+    // with any error. The other result takes our column names if it has no
+    // rows yet.
+    // This is how rows streamed on a worker thread get handed to the UI.
+    void MoveRowsTo(ResultSet *dest);
+
+    // Sort the rows we have so far, without moving any cell data: only a
+    // permutation of row indices is sorted, on several threads if it's big.
+    // An empty list of keys puts the rows back in their original order.
+    // Text is compared as bytes, whatever collation the column was declared
+    // with, so this is only for results that can't be run again with an
+    // "order by" (see CanRequery()), such as the last one of a script.
+    void Sort(const std::vector<SortKey>& keys);
+
+    // Drop the rows whose entry in keep (by displayed row) is zero. The rest
+    // stay in the order they are shown in. The text of dropped rows stays
+    // in the arena until the whole result is cleared.
+    void KeepRows(const std::vector<unsigned char>& keep);
+
+    // True if rows arrived since the last call to Sort().
+    bool NeedsSort() const { return !sort_keys.empty() && (int)order.size() != rows; }
+    const std::vector<SortKey>& SortKeys() const { return sort_keys; }
+
+    // True if this came from a single select statement, which can be
+    // run again with an "order by" instead of sorting the rows ourselves.
+    bool CanRequery() const { return can_requery; }
+
+    // Whether the (last) statement leaves the database as it is, as far as
+    // sqlite3_stmt_readonly() can tell.
+    bool ReadOnly() const { return read_only; }
+
+    // The text of the (last) statement, without anything that came after it.
+    const std::string& Sql() const { return sql; }
+
+    // Time spent preparing and fetching so far.
+    double Seconds() const { return seconds; }
+    // Virtual machine steps the statement took, once it is done.
+    int VMSteps() const { return vm_steps; }
+
+    // Actual loop counts of the finished statement, if SQLite collects them.
+    const std::vector<ScanStatus>& Scans() const { return scans; }
+    // Rows inserted, updated or deleted by the statement, once it is done.
+    int Changes() const { return changes; }
+
+    bool IsDone() const { return stmt == NULL; }
+    // True for a statement that was skipped instead of run, see Skip().
+    bool NotRun() const { return not_run; }
+    bool HasError() const { return !error.empty(); }
+    const std::string& Error() const { return error; }
+
+    int Rows() const { return rows; }
+    int Columns() const { return (int)columns.size(); }
+    const char *ColumnName(int col) const { return columns[col].name.c_str(); }
+    // The type the column was declared with in its table, which decides how
+    // SQLite compares it. Empty for an expression, or a column with no type.
+    const std::string& ColumnDeclaredType(int col) const { return columns[col].declared_type; }
+
+    // SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or SQLITE_NULL
+    int Type(int row, int col) const { return columns[col].types[Stored(row)]; }
+    sqlite3_int64 GetInt64(int row, int col) const { return columns[col].values[Stored(row)].integer; }
+    double GetDouble(int row, int col) const { return columns[col].values[Stored(row)].real; }
+
+    // The text of a TEXT or BLOB cell, or NULL for any other type.
+    const char *GetText(int row, int col) const
+    {
+        row = Stored(row);
+        const Column& column = columns[col];
+        int type = column.types[row];
+        if (type != SQLITE_TEXT && type != SQLITE_BLOB) return NULL;
+        return column.values[row].text;
+    }
+    // The size in bytes of a TEXT or BLOB cell, which may hold NULs, or 0.
+    int GetBytes(int row, int col) const { return columns[col].lengths[Stored(row)]; }
+
+    // Memory taken by the TEXT and BLOB cells, including their '\0's, and
+    // what was allocated to hold them.
+    size_t TextBytes() const { return strings.BytesUsed(); }
+    size_t TextBytesAllocated() const { return strings.BytesAllocated(); }
+
+    // Any cell as text, for display. Numbers are formatted into buf the same
+    // way SQLite would. Returns NULL if the value is SQL NULL.
+    const char *FormatCell(int row, int col, char *buf, int size) const;
+
+private:
+    ResultSet(const ResultSet&);
+    ResultSet& operator=(const ResultSet&);
+
+    bool Prepare(sqlite3 *db, StatementCache *cache, const char *query, const char **tail);
+    int PrepareStatement(const char *query, const char **tail);
+    void ReadColumns();
+    void ReleaseStatement();
+    void Finish(int rc);
+
+    sqlite3_stmt *stmt;
+    sqlite3 *db;
+    StatementCache *cache;
+    std::string error;
+    double seconds;
+    int vm_steps;
+    int changes;
+    std::vector<ScanStatus> scans;
+
+    union Value
+    {
+        sqlite3_int64 integer;  // SQLITE_INTEGER
+        double real;            // SQLITE_FLOAT
+        const char *text;       // SQLITE_TEXT, SQLITE_BLOB: in strings
+    };
+
+    struct Column
+    {
+        std::string name;
+        std::string declared_type;
+        std::vector<unsigned char> types;
+        std::vector<Value> values;
+        std::vector<int> lengths;  // TEXT, BLOB: in bytes
+    };
+
+    struct RowLess;
+
+    // display row -> stored row
+    int Stored(int row) const { return row < (int)order.size() ? order[row] : row; }
+
+    int rows;
+    std::vector<Column> columns;
+    StringArena strings;  // every TEXT and BLOB value
+    bool can_requery;
+    bool read_only;
+    bool not_run;
+    std::string sql;
+
+    std::vector<SortKey> sort_keys;
+    std::vector<int> order;  // display row -> stored row, if sorted
+};
@@ -0,0 +1,129 @@
+#include "schema_catalog.h"
+
+#include <stdio.h>
+#include <sqlite3.h>
+
+#include "database.h"
+#include "statement_cache.h"
+
+static std::string ColumnText(sqlite3_stmt *stmt, int col)
+{
+    const char *text = (const char *)sqlite3_column_text(stmt, col);
+    return text ? text : "";
+}
+
+SchemaCatalog::SchemaCatalog()
+: version(-1)
+{
+}
+
+bool SchemaCatalog::Update(StatementCache *statements)
+{
+    int schema_version = PragmaInt(statements, "pragma schema_version");
+    if (schema_version == version && schema_version != -1) {
+        return false;
+    }
+
+    Clear();
+    if (!Load(statements)) {
+        fprintf(stderr, "SQL error: %s\n", error.c_str());
+        tables.clear();
+    }
+    // a failure is tried again once the schema changes, not every frame
+    version = schema_version;
+    return true;
+}
+
+void SchemaCatalog::Clear()
+{
+    tables.clear();
+    version = -1;
+    error.clear();
+}
+
+const CatalogTable *SchemaCatalog::Find(const char *name) const
+{
+    for (const CatalogTable& table : tables) {
+        if (!sqlite3_stricmp(table.name.c_str(), name)) return &table;
+    }
+    return NULL;
+}
+
+bool SchemaCatalog::Load(StatementCache *statements)
+{
+    sqlite3 *db = statements->Database();
+
+    // Each of these is prepared once and run for every table, with the
+    // table name bound to it, using the pragmas' table-valued forms.
+    struct Query
+    {
+        const char *sql;
+        sqlite3_stmt *stmt;
+    };
+    Query names = { "select name from sqlite_master where type='table'", NULL };
+    Query columns = { "select name, type, \"notnull\", dflt_value, pk from pragma_table_info(?1)", NULL };
+    Query indexes = { "select name, \"unique\", origin, partial from pragma_index_list(?1)", NULL };
+    Query foreign_keys = { "select id, \"table\", \"from\", \"to\", on_update, on_delete from pragma_foreign_key_list(?1)", NULL };
+    Query *queries[] = { &names, &columns, &indexes, &foreign_keys };
+
+    bool ok = true;
+    for (Query *query : queries) {
+        query->stmt = statements->Acquire(query->sql);
+        if (!query->stmt) ok = false;
+    }
+
+    int rc = SQLITE_DONE;
+    while (ok && (rc = sqlite3_step(names.stmt)) == SQLITE_ROW) {
+        tables.push_back(CatalogTable());
+        CatalogTable& table = tables.back();
+        table.name = ColumnText(names.stmt, 0);
+
+        sqlite3_bind_text(columns.stmt, 1, table.name.c_str(), -1, SQLITE_STATIC);
+        while ((rc = sqlite3_step(columns.stmt)) == SQLITE_ROW) {
+            CatalogColumn column;
+            column.name = ColumnText(columns.stmt, 0);
+            column.type = ColumnText(columns.stmt, 1);
+            column.not_null = sqlite3_column_int(columns.stmt, 2) != 0;
+            column.default_value = ColumnText(columns.stmt, 3);
+            column.primary_key = sqlite3_column_int(columns.stmt, 4);
+            table.columns.push_back(column);
+        }
+        sqlite3_reset(columns.stmt);
+        if (rc != SQLITE_DONE) break;
+
+        sqlite3_bind_text(indexes.stmt, 1, table.name.c_str(), -1, SQLITE_STATIC);
+        while ((rc = sqlite3_step(indexes.stmt)) == SQLITE_ROW) {
+            CatalogIndex index;
+            index.name = ColumnText(indexes.stmt, 0);
+            index.unique = sqlite3_column_int(indexes.stmt, 1) != 0;
+            index.origin = ColumnText(indexes.stmt, 2);
+            index.partial = sqlite3_column_int(indexes.stmt, 3) != 0;
+            table.indexes.push_back(index);
+        }
+        sqlite3_reset(indexes.stmt);
+        if (rc != SQLITE_DONE) break;
+
+        sqlite3_bind_text(foreign_keys.stmt, 1, table.name.c_str(), -1, SQLITE_STATIC);
+        while ((rc = sqlite3_step(foreign_keys.stmt)) == SQLITE_ROW) {
+            CatalogForeignKey key;
+            key.id = sqlite3_column_int(foreign_keys.stmt, 0);
+            key.table = ColumnText(foreign_keys.stmt, 1);
+            key.from = ColumnText(foreign_keys.stmt, 2);
+            key.to = ColumnText(foreign_keys.stmt, 3);
+            key.on_update = ColumnText(foreign_keys.stmt, 4);
+            key.on_delete = ColumnText(foreign_keys.stmt, 5);
+            table.foreign_keys.push_back(key);
+        }
+        sqlite3_reset(foreign_keys.stmt);
+        if (rc != SQLITE_DONE) break;
+    }
+
+    if (!ok || rc != SQLITE_DONE) {
+        ok = false;
+        error = sqlite3_errmsg(db);
+    }
+    for (Query *query : queries) {
+        statements->Release(query->stmt);
+    }
+    return ok;
+}
@@ -0,0 +1,81 @@
+// SchemaCatalog - the tables in the database, with their columns, indexes
+// and foreign keys.
+//
+// Everything that lists tables or columns reads it from here, so none of
+// them has to query the database each frame. The catalog is read with the
+// table_info, index_list and foreign_key_list pragmas, and read again only
+// when the schema_version pragma says the schema has changed.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class StatementCache;
+
+struct CatalogColumn
+{
+    std::string name;
+    std::string type;           // as declared, possibly empty
+    bool not_null = false;
+    std::string default_value;  // the SQL text of the default, empty if none
+    int primary_key = 0;        // position in the primary key, 0 if not part of it
+};
+
+struct CatalogIndex
+{
+    std::string name;
+    bool unique = false;
+    std::string origin;         // "c" create index, "u" unique constraint, "pk" primary key
+    bool partial = false;
+};
+
+struct CatalogForeignKey
+{
+    int id = 0;                 // columns of one multi-column key share an id
+    std::string table;          // the table referred to
+    std::string from;           // our column
+    std::string to;             // its column, empty for its primary key
+    std::string on_update;
+    std::string on_delete;
+};
+
+struct CatalogTable
+{
+    std::string name;
+    std::vector<CatalogColumn> columns;
+    std::vector<CatalogIndex> indexes;
+    std::vector<CatalogForeignKey> foreign_keys;
+};
+
+class SchemaCatalog
+{
+public:
+    SchemaCatalog();
+
+    // Read the schema again if it has changed since we last did, or was
+    // never read. Returns true if it was read.
+    bool Update(StatementCache *statements);
+
+    // Forget everything, so the next Update() reads the schema afresh.
+    void Clear();
+
+    // The tables, in the order sqlite_master has them.
+    const std::vector<CatalogTable>& Tables() const { return tables; }
+
+    // The table with this name (ignoring ASCII case, as SQLite does), or NULL.
+    const CatalogTable *Find(const char *name) const;
+
+    // The schema_version the catalog was read at, or -1.
+    int Version() const { return version; }
+
+    // Why the last Update() failed, if it did.
+    const std::string& Error() const { return error; }
+
+private:
+    bool Load(StatementCache *statements);
+
+    std::vector<CatalogTable> tables;
+    int version;
+    std::string error;
+};
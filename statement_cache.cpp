@@ -0,0 +1,216 @@
+#include "statement_cache.h"
+
+#include <string.h>
+
+StatementCache::StatementCache(sqlite3 *db, size_t capacity)
+: db(db)
+, capacity(capacity)
+, schema_version_stmt(NULL)
+, schema_version(-1)
+, hits(0)
+, misses(0)
+, size(0)
+{
+}
+
+StatementCache::~StatementCache()
+{
+    Clear();
+    for (EntryList::iterator it = entries.begin(); it != entries.end(); ++it) {
+        sqlite3_finalize(it->stmt);
+    }
+    sqlite3_finalize(schema_version_stmt);
+}
+
+void StatementCache::Clear()
+{
+    EntryList::iterator it = entries.begin();
+    while (it != entries.end()) {
+        if (it->in_use) {
+            // finalized when it is released
+            it->stale = true;
+            by_key.erase(it->key);
+            it->key.clear();
+            ++it;
+            continue;
+        }
+        by_key.erase(it->key);
+        by_stmt.erase(it->stmt);
+        sqlite3_finalize(it->stmt);
+        it = entries.erase(it);
+    }
+    size = (int)entries.size();
+}
+
+bool StatementCache::CheckSchema()
+{
+    if (schema_version_stmt == NULL) {
+        if (sqlite3_prepare_v2(db, "pragma schema_version", -1, &schema_version_stmt, NULL) != SQLITE_OK) {
+            return false;
+        }
+    }
+    int version = -1;
+    if (sqlite3_step(schema_version_stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(schema_version_stmt, 0);
+    }
+    sqlite3_reset(schema_version_stmt);
+
+    if (version == schema_version) {
+        return false;
+    }
+    Clear();
+    schema_version = version;
+    return true;
+}
+
+void StatementCache::Evict()
+{
+    // drop the least recently used statements that aren't in use
+    EntryList::iterator it = entries.end();
+    while (entries.size() > capacity && it != entries.begin()) {
+        --it;
+        if (it->in_use) continue;
+        by_key.erase(it->key);
+        by_stmt.erase(it->stmt);
+        sqlite3_finalize(it->stmt);
+        it = entries.erase(it);
+    }
+    size = (int)entries.size();
+}
+
+sqlite3_stmt *StatementCache::Acquire(const char *sql, const char **tail, int *rc)
+{
+    if (rc) *rc = SQLITE_OK;
+
+    const char *end = StatementEnd(sql);
+    if (tail) *tail = end;
+    std::string key = NormalizeSql(sql, end);
+    if (key.empty()) {
+        return NULL;
+    }
+
+    std::unordered_map<std::string, EntryList::iterator>::iterator found = by_key.find(key);
+    if (found != by_key.end() && !found->second->in_use) {
+        EntryList::iterator entry = found->second;
+        entries.splice(entries.begin(), entries, entry);
+        entry->in_use = true;
+        sqlite3_reset(entry->stmt);
+        sqlite3_clear_bindings(entry->stmt);
+        hits++;
+        return entry->stmt;
+    }
+
+    misses++;
+    sqlite3_stmt *stmt = NULL;
+    int result = sqlite3_prepare_v2(db, sql, (int)(end - sql), &stmt, NULL);
+    if (rc) *rc = result;
+    if (result != SQLITE_OK || stmt == NULL) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+
+    Entry entry;
+    entry.stmt = stmt;
+    entry.in_use = true;
+    entry.stale = false;
+    // the same SQL may be in use twice at once, only one copy is kept
+    if (found == by_key.end()) {
+        entry.key = key;
+    }
+    entries.push_front(entry);
+    if (!entry.key.empty()) {
+        by_key[key] = entries.begin();
+    }else{
+        entries.front().stale = true;
+    }
+    by_stmt[stmt] = entries.begin();
+    Evict();
+    return stmt;
+}
+
+void StatementCache::Release(sqlite3_stmt *stmt)
+{
+    if (stmt == NULL) return;
+
+    std::unordered_map<sqlite3_stmt*, EntryList::iterator>::iterator found = by_stmt.find(stmt);
+    if (found == by_stmt.end()) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    EntryList::iterator entry = found->second;
+    if (entry->stale) {
+        by_stmt.erase(found);
+        sqlite3_finalize(stmt);
+        entries.erase(entry);
+    }else{
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        // so the next user sees counts for their run only
+        sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+        sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+        sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+#ifdef SQLITE_ENABLE_STMT_SCANSTATUS
+        sqlite3_stmt_scanstatus_reset(stmt);
+#endif
+        entry->in_use = false;
+    }
+    Evict();
+}
+
+const char *StatementEnd(const char *sql)
+{
+    // sqlite3_complete() knows about quotes, comments and triggers,
+    // so we just ask it about each ';' in turn.
+    std::string candidate;
+    for (const char *p = strchr(sql, ';'); p; p = strchr(p + 1, ';')) {
+        candidate.assign(sql, p + 1);
+        if (sqlite3_complete(candidate.c_str())) {
+            return p + 1;
+        }
+    }
+    return sql + strlen(sql);
+}
+
+std::string NormalizeSql(const char *sql, const char *end)
+{
+    std::string key;
+    bool space = false;
+    const char *p = sql;
+    while (p < end) {
+        char c = *p;
+        if (c == '-' && p + 1 < end && p[1] == '-') {
+            while (p < end && *p != '\n') p++;
+            space = true;
+        }else if (c == '/' && p + 1 < end && p[1] == '*') {
+            p += 2;
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) p++;
+            p = p + 2 < end ? p + 2 : end;
+            space = true;
+        }else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f') {
+            p++;
+            space = true;
+        }else if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            // copy quoted text as is
+            char close = c == '[' ? ']' : c;
+            if (space && !key.empty()) key += ' ';
+            space = false;
+            const char *start = p++;
+            while (p < end && *p != close) p++;
+            if (p < end) p++;
+            key.append(start, p);
+        }else{
+            if (space && !key.empty()) key += ' ';
+            space = false;
+            key += c;
+            p++;
+        }
+    }
+    // a doubled quote inside quotes just looks like two quoted strings
+    // back to back, which is copied the same way
+    while (!key.empty() && (key[key.size()-1] == ';' || key[key.size()-1] == ' ')) {
+        key.erase(key.size()-1);
+    }
+    return key;
+}
@@ -0,0 +1,91 @@
+// StatementCache - reuses prepared statements for SQL we have seen before.
+//
+// Statements are kept in a bounded LRU list, keyed by a normalized form of
+// their SQL text (comments removed, runs of whitespace collapsed). When the
+// same SQL comes along again the statement is reset and handed out again,
+// skipping the parse and the query planner.
+//
+// Looking a statement up doesn't touch the database at all. A statement
+// prepared before a schema change still works, since SQLite prepares it
+// again on its first step, but to have the cache start afresh its owner
+// calls CheckSchema() once per frame or per query run.
+//
+// Each cache belongs to one connection, and is used from one thread.
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <sqlite3.h>
+
+class StatementCache
+{
+public:
+    StatementCache(sqlite3 *db, size_t capacity);
+    ~StatementCache();
+
+    // Prepare the first statement in sql, or reuse a cached one, and set
+    // *tail to the text after it. Returns NULL if there was no statement,
+    // or on error, in which case rc (if given) gets the error code.
+    // The statement must be given back with Release(), not finalized.
+    sqlite3_stmt *Acquire(const char *sql, const char **tail = NULL, int *rc = NULL);
+
+    // Give back a statement from Acquire(). It is reset, so any rows it
+    // had not returned yet are gone, and kept around for next time.
+    void Release(sqlite3_stmt *stmt);
+
+    // Finalize every statement that isn't in use right now.
+    void Clear();
+
+    // Clear() if the schema has changed since the last call. Returns true
+    // if it had (or this is the first call).
+    bool CheckSchema();
+
+    sqlite3 *Database() const { return db; }
+
+    // Is this one of the statements the cache runs for itself?
+    bool IsInternal(sqlite3_stmt *stmt) const { return stmt == schema_version_stmt; }
+
+    // Counters for the diagnostics panel. These may be read from any thread.
+    long long Hits() const { return hits; }
+    long long Misses() const { return misses; }
+    int Size() const { return size; }
+
+private:
+    StatementCache(const StatementCache&);
+    StatementCache& operator=(const StatementCache&);
+
+    struct Entry
+    {
+        std::string key;
+        sqlite3_stmt *stmt;
+        bool in_use;
+        bool stale;  // the schema changed while it was in use
+    };
+    typedef std::list<Entry> EntryList;
+
+    void Evict();
+
+    sqlite3 *db;
+    size_t capacity;
+    EntryList entries;  // most recently used first
+    std::unordered_map<std::string, EntryList::iterator> by_key;
+    std::unordered_map<sqlite3_stmt*, EntryList::iterator> by_stmt;
+
+    sqlite3_stmt *schema_version_stmt;
+    int schema_version;
+
+    std::atomic<long long> hits;
+    std::atomic<long long> misses;
+    std::atomic<int> size;
+};
+
+// The text of sql up to and including the ';' that ends its first statement,
+// or up to the end of the text.
+const char *StatementEnd(const char *sql);
+
+// The key a statement is cached under: comments dropped, whitespace outside
+// of quotes collapsed to single spaces, trailing ';' removed.
+std::string NormalizeSql(const char *sql, const char *end);
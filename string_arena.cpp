@@ -0,0 +1,78 @@
+#include "string_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Chunks start small, so that a short result doesn't cost much,
+// and double in size up to a limit as the arena fills up.
+static const size_t min_chunk_size = 64 * 1024;
+static const size_t max_chunk_size = 4 * 1024 * 1024;
+
+StringArena::StringArena()
+: next_chunk_size(min_chunk_size)
+{
+}
+
+StringArena::~StringArena()
+{
+    Clear();
+}
+
+void StringArena::Clear()
+{
+    for (size_t i=0; i<chunks.size(); i++) {
+        free(chunks[i].data);
+    }
+    chunks.clear();
+    next_chunk_size = min_chunk_size;
+}
+
+const char *StringArena::Store(const char *bytes, size_t length)
+{
+    size_t needed = length + 1;
+    if (chunks.empty() || chunks.back().size - chunks.back().used < needed) {
+        size_t size = std::max(next_chunk_size, needed);
+        next_chunk_size = std::min(next_chunk_size * 2, max_chunk_size);
+
+        Chunk chunk;
+        chunk.data = (char *)malloc(size);
+        if (chunk.data == NULL) return "";
+        chunk.size = size;
+        chunk.used = 0;
+        chunks.push_back(chunk);
+    }
+
+    Chunk& chunk = chunks.back();
+    char *copy = chunk.data + chunk.used;
+    memcpy(copy, bytes, length);
+    copy[length] = '\0';
+    chunk.used += needed;
+    return copy;
+}
+
+void StringArena::TakeFrom(StringArena *other)
+{
+    if (chunks.empty()) {
+        chunks.swap(other->chunks);
+        return;
+    }
+    // The last chunk stays last, so that we keep filling up its free space.
+    chunks.insert(chunks.end() - 1, other->chunks.begin(), other->chunks.end());
+    other->chunks.clear();
+    // other keeps its chunk size, since it's likely to be filled up again
+}
+
+size_t StringArena::BytesUsed() const
+{
+    size_t total = 0;
+    for (size_t i=0; i<chunks.size(); i++) total += chunks[i].used;
+    return total;
+}
+
+size_t StringArena::BytesAllocated() const
+{
+    size_t total = 0;
+    for (size_t i=0; i<chunks.size(); i++) total += chunks[i].size;
+    return total;
+}
@@ -0,0 +1,44 @@
+// StringArena - a bump allocator for the text of a result set.
+//
+// Strings are copied into large chunks, one after another, and are never
+// freed individually: the whole arena goes at once. So storing a million
+// strings costs a handful of allocations, and so does freeing them.
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+class StringArena
+{
+public:
+    StringArena();
+    ~StringArena();
+
+    // Copy length bytes into the arena, followed by a '\0'. The copy stays
+    // where it is until the arena is cleared, even as more strings are added.
+    const char *Store(const char *bytes, size_t length);
+
+    // Take over all of other's chunks, leaving it empty. Nothing is copied,
+    // so strings from other stay valid, now owned by this arena.
+    void TakeFrom(StringArena *other);
+
+    // Free everything.
+    void Clear();
+
+    size_t BytesUsed() const;
+    size_t BytesAllocated() const;
+
+private:
+    StringArena(const StringArena&);
+    StringArena& operator=(const StringArena&);
+
+    struct Chunk
+    {
+        char *data;
+        size_t size;
+        size_t used;
+    };
+    std::vector<Chunk> chunks;
+    size_t next_chunk_size;
+};
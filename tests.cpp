@@ -0,0 +1,1031 @@
+// sql-gui-tests - checks of the core library, on its own.
+//
+// Links only the core library, like sql-gui-bench. Each check that fails
+// is printed, and then "make test" fails. Scratch files are made in the
+// current directory, and removed again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sqlite3.h>
+
+#include "connection_pool.h"
+#include "database.h"
+#include "exporter.h"
+#include "importer.h"
+#include "predicate.h"
+#include "query_plan.h"
+#include "query_worker.h"
+#include "result_set.h"
+#include "schema_catalog.h"
+#include "statement_cache.h"
+#include "string_arena.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+static bool Check(bool ok, const char *what, const char *file, int line)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        fprintf(stderr, "%s:%d: failed: %s\n", file, line, what);
+    }
+    return ok;
+}
+
+// The same numbers on every run, so a failure can be run again.
+static unsigned int random_state = 1;
+
+static int Random(int n)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (int)((random_state >> 8) % (unsigned int)n);
+}
+
+static void Exec(sqlite3 *db, const char *sql)
+{
+    char *message = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &message) != SQLITE_OK) {
+        Check(false, message ? message : sql, __FILE__, __LINE__);
+        sqlite3_free(message);
+    }
+}
+
+static sqlite3 *OpenMemory()
+{
+    sqlite3 *db = NULL;
+    sqlite3_open(":memory:", &db);
+    return db;
+}
+
+static sqlite3_int64 QueryInt(sqlite3 *db, const std::string& sql)
+{
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_int64 value = -1;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int64(stmt, 0);
+    }else{
+        Check(false, sqlite3_errmsg(db), __FILE__, __LINE__);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+// Database
+
+static void TestOpenDatabase()
+{
+    std::string error;
+    OpenOptions options;
+
+    // with no file, every connection gets the same in-memory database
+    sqlite3 *a = OpenDatabase("", options, &error);
+    sqlite3 *b = OpenDatabase("", options, &error);
+    CHECK(a != NULL && b != NULL);
+    if (a && b) {
+        Exec(a, "create table shared(x); insert into shared values (42);");
+        sqlite3_stmt *stmt = NULL;
+        CHECK(sqlite3_prepare_v2(b, "select x from shared", -1, &stmt, NULL) == SQLITE_OK);
+        CHECK(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 42);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(a);
+    sqlite3_close(b);
+
+    // a file that isn't there is only made if the options say so
+    const char *path = "sql-gui-tests-missing.db";
+    remove(path);
+    options.create = false;
+    CHECK(OpenDatabase(path, options, &error) == NULL);
+    CHECK(!error.empty());
+    options.create = true;
+    sqlite3 *created = OpenDatabase(path, options, &error);
+    CHECK(created != NULL);
+    sqlite3_close(created);
+    remove(path);
+}
+
+// Parse one option, with its value if it has one, as from a command line.
+static bool ParseOption(const char *option, const char *value, OpenOptions *options, std::string *error)
+{
+    char *argv[] = {(char *)option, (char *)value};
+    int i = 0;
+    bool parsed = ParseOpenOption(value ? 2 : 1, argv, &i, options, error);
+    return parsed && error->empty() && i == (value ? 1 : 0);
+}
+
+static void TestOpenOptions()
+{
+    OpenOptions options;
+    std::string error;
+    CHECK(ParseOption("--readonly", NULL, &options, &error) && options.readonly);
+    CHECK(ParseOption("--immutable", NULL, &options, &error) && options.immutable);
+    CHECK(ParseOption("--mmap-size", "4096", &options, &error) && options.mmap_size == 4096);
+    CHECK(ParseOption("--mmap-size", "0", &options, &error) && options.mmap_size == 0);
+    CHECK(ParseOption("--mmap-size", "64k", &options, &error) && options.mmap_size == 64 << 10);
+    CHECK(ParseOption("--mmap-size", "256M", &options, &error) && options.mmap_size == 256 << 20);
+    CHECK(ParseOption("--mmap-size", "4G", &options, &error) && options.mmap_size == 4LL << 30);
+
+    // anything else is an error, and leaves the size as it was
+    const char *bad[] = {"abc", "1x", "", "-1G", "-1", "+5", " 5", "4GB", "9223372036854775807k", "99999999999999999999"};
+    for (const char *value : bad) {
+        error.clear();
+        options.mmap_size = 123;
+        Check(!ParseOption("--mmap-size", value, &options, &error) && !error.empty() && options.mmap_size == 123,
+            value, __FILE__, __LINE__);
+    }
+    error.clear();
+    CHECK(!ParseOption("--mmap-size", NULL, &options, &error) && !error.empty());
+
+    // and what isn't an option at all is left for the caller
+    error.clear();
+    CHECK(!ParseOption("database.db", NULL, &options, &error) && error.empty());
+}
+
+// ResultSet
+
+static void TestStreaming()
+{
+    sqlite3 *db = OpenMemory();
+    Exec(db, "create table t(id integer primary key, name text);"
+        "with recursive n(i) as (select 1 union all select i+1 from n where i < 1000) "
+        "insert into t select i, 'row ' || i from n;");
+
+    ResultSet result;
+    CHECK(result.Prepare(db, "select id, name from t order by id"));
+    CHECK(result.Columns() == 2);
+    CHECK(!strcmp(result.ColumnName(1), "name"));
+    CHECK(result.Rows() == 0);
+
+    // a chunk at a time, with the statement still open in between
+    CHECK(result.Fetch(300, 1000) == 300);
+    CHECK(result.Rows() == 300);
+    CHECK(!result.IsDone());
+    while (!result.IsDone()) {
+        result.Fetch(300, 1000);
+    }
+    CHECK(result.Rows() == 1000);
+    CHECK(!result.HasError());
+
+    bool ok = true;
+    for (int row=0; row<result.Rows(); row++) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "row %d", row + 1);
+        ok = ok && result.Type(row, 0) == SQLITE_INTEGER && result.GetInt64(row, 0) == row + 1;
+        ok = ok && result.GetText(row, 1) && !strcmp(result.GetText(row, 1), expected);
+    }
+    CHECK(ok);
+
+    // the statements before the last one are run, and only it is streamed
+    ResultSet script;
+    CHECK(script.Prepare(db, "create table s(x); insert into s values (1), (2); select x from s"));
+    script.Fetch(100, 1000);
+    CHECK(script.IsDone() && script.Rows() == 2);
+
+    ResultSet bad;
+    CHECK(!bad.Prepare(db, "select * from nowhere"));
+    CHECK(bad.HasError());
+
+    result.Clear();
+    script.Clear();
+    sqlite3_close(db);
+}
+
+static void TestMoveRowsTo()
+{
+    sqlite3 *db = OpenMemory();
+    ResultSet source;
+    CHECK(source.Prepare(db,
+        "with recursive n(i) as (select 1 union all select i+1 from n where i < 500) "
+        "select i, case i % 4 when 0 then null when 1 then i * 0.5 when 2 then 'text ' || i else cast(i as blob) end from n"));
+
+    // the way a worker hands its rows to the UI, a chunk at a time
+    ResultSet dest;
+    while (!source.IsDone()) {
+        source.Fetch(37, 1000);
+        source.MoveRowsTo(&dest);
+        CHECK(source.Rows() == 0);
+    }
+    CHECK(dest.Rows() == 500);
+    CHECK(dest.Columns() == 2);
+
+    bool ok = true;
+    for (int row=0; row<dest.Rows(); row++) {
+        int i = row + 1;
+        char text[32];
+        ok = ok && dest.GetInt64(row, 0) == i;
+        switch (i % 4) {
+        case 0:
+            ok = ok && dest.Type(row, 1) == SQLITE_NULL;
+            break;
+        case 1:
+            ok = ok && dest.Type(row, 1) == SQLITE_FLOAT && dest.GetDouble(row, 1) == i * 0.5;
+            break;
+        case 2:
+            snprintf(text, sizeof(text), "text %d", i);
+            ok = ok && dest.Type(row, 1) == SQLITE_TEXT && !strcmp(dest.GetText(row, 1), text);
+            ok = ok && dest.GetBytes(row, 1) == (int)strlen(text);
+            break;
+        case 3:
+            snprintf(text, sizeof(text), "%d", i);
+            ok = ok && dest.Type(row, 1) == SQLITE_BLOB && dest.GetBytes(row, 1) == (int)strlen(text);
+            ok = ok && !memcmp(dest.GetText(row, 1), text, strlen(text));
+            break;
+        }
+    }
+    CHECK(ok);
+
+    source.Clear();
+    dest.Clear();
+    sqlite3_close(db);
+}
+
+// QueryWorker
+
+// Cancels the worker as a statement of its script commits. By then the
+// statement has nothing left to interrupt, like a cancel that comes
+// between two statements.
+struct CancelOnCommit
+{
+    QueryWorker *worker;
+    int commits;  // to let through before cancelling
+};
+
+static int CancelWorker(void *data)
+{
+    CancelOnCommit *cancel = (CancelOnCommit *)data;
+    if (cancel->commits-- == 0) cancel->worker->Cancel();
+    return 0;
+}
+
+static void TestScriptCancel()
+{
+    ConnectionPool pool;
+    OpenOptions options;
+    if (!CHECK(pool.Open("", options))) return;
+
+    QueryWorker worker;
+    CHECK(worker.Open(&pool));
+    CancelOnCommit cancel = {&worker, 1};
+    sqlite3 *writer = pool.LockWriter(10);
+    sqlite3_commit_hook(writer, CancelWorker, &cancel);
+    pool.UnlockWriter();
+
+    worker.Run("create table cancelled(x);\n"
+        "insert into cancelled values (1);\n"
+        "insert into cancelled values (2);\n"
+        "insert into cancelled values (3);");
+    while (worker.IsBusy()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::vector<std::unique_ptr<ResultSet> > results;
+    worker.Poll(&results);
+    CHECK(results.size() == 4);
+    if (results.size() == 4) {
+        CHECK(!results[1]->NotRun() && !results[1]->HasError());
+        // the rest are listed, but not run
+        CHECK(results[2]->NotRun() && results[3]->NotRun());
+        CHECK(results[2]->Sql() == "insert into cancelled values (2);");
+        CHECK(results[3]->Sql() == "insert into cancelled values (3);");
+    }
+
+    // nothing after the cancel wrote anything
+    writer = pool.LockWriter(10);
+    sqlite3_commit_hook(writer, NULL, NULL);
+    CHECK(QueryInt(writer, "select count(*) from cancelled") == 1);
+    pool.UnlockWriter();
+}
+
+// StringArena
+
+static void TestStringArena()
+{
+    StringArena arena;
+    CHECK(arena.BytesUsed() == 0 && arena.BytesAllocated() == 0);
+
+    // strings stay put, and readable, as more are added
+    std::vector<const char *> stored;
+    for (int i=0; i<100000; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "string %d", i);
+        stored.push_back(arena.Store(text, strlen(text)));
+    }
+    bool ok = true;
+    size_t used = 0;
+    for (int i=0; i<100000; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "string %d", i);
+        ok = ok && !strcmp(stored[i], text);
+        used += strlen(text) + 1;
+    }
+    CHECK(ok);
+    CHECK(arena.BytesUsed() == used);
+    CHECK(arena.BytesAllocated() >= used);
+
+    // handing the chunks over copies nothing
+    StringArena other;
+    const char *moved = other.Store("moved", 5);
+    arena.TakeFrom(&other);
+    CHECK(other.BytesUsed() == 0 && other.BytesAllocated() == 0);
+    CHECK(arena.BytesUsed() == used + 6);
+    CHECK(!strcmp(moved, "moved") && !strcmp(stored[0], "string 0"));
+
+    arena.Clear();
+    CHECK(arena.BytesUsed() == 0 && arena.BytesAllocated() == 0);
+}
+
+// Sorting
+
+static bool IsNumber(int type)
+{
+    return type == SQLITE_INTEGER || type == SQLITE_FLOAT;
+}
+
+// 2 and 2.0 are equal, and so may be sorted either way round; 2^63-1 and
+// 2^63 are not.
+static bool NumbersEqual(const ResultSet& a, const ResultSet& b, int row, int col)
+{
+    if (a.Type(row, col) == SQLITE_INTEGER && b.Type(row, col) == SQLITE_INTEGER) {
+        return a.GetInt64(row, col) == b.GetInt64(row, col);
+    }
+    if (a.Type(row, col) == SQLITE_FLOAT && b.Type(row, col) == SQLITE_FLOAT) {
+        return a.GetDouble(row, col) == b.GetDouble(row, col);
+    }
+    const ResultSet& integer = a.Type(row, col) == SQLITE_INTEGER ? a : b;
+    const ResultSet& real = a.Type(row, col) == SQLITE_INTEGER ? b : a;
+    double r = real.GetDouble(row, col);
+    return r >= -9223372036854775808.0 && r < 9223372036854775808.0 &&
+        (sqlite3_int64)r == integer.GetInt64(row, col) && (double)(sqlite3_int64)r == r;
+}
+
+// Sort the rows ourselves, and check them against SQLite's own order by.
+static void CheckSort(sqlite3 *db, const char *table, const std::vector<SortKey>& keys)
+{
+    std::string sql = std::string("select * from ") + table;
+
+    ResultSet ours;
+    ours.Prepare(db, sql.c_str());
+    while (!ours.IsDone()) {
+        ours.Fetch(1000, 1000);
+    }
+    ours.Sort(keys);
+
+    ResultSet theirs;
+    theirs.Prepare(db, SortedQuery(sql, keys).c_str());
+    while (!theirs.IsDone()) {
+        theirs.Fetch(1000, 1000);
+    }
+
+    // ties may come in any order, so only the sort columns are compared
+    bool ok = ours.Rows() == theirs.Rows();
+    for (int row=0; ok && row<ours.Rows(); row++) {
+        for (const SortKey& key : keys) {
+            int col = key.column;
+            int type = ours.Type(row, col);
+            if (IsNumber(type) && IsNumber(theirs.Type(row, col))) {
+                ok = NumbersEqual(ours, theirs, row, col);
+                if (!ok) break;
+                continue;
+            }
+            ok = ok && type == theirs.Type(row, col);
+            if (!ok) break;
+            if (type == SQLITE_TEXT || type == SQLITE_BLOB) {
+                ok = ours.GetBytes(row, col) == theirs.GetBytes(row, col) &&
+                    !memcmp(ours.GetText(row, col), theirs.GetText(row, col), ours.GetBytes(row, col));
+            }
+        }
+    }
+    CHECK(ok);
+}
+
+static void TestSort()
+{
+    sqlite3 *db = OpenMemory();
+    // text and blobs compare by their bytes, whatever their collation
+    Exec(db, "create table words(a, b);"
+        "insert into words values ('abc', 'a'), ('ab', 'd'), ('', 'e'), (null, 'c'), ('b', 'b'),"
+        " (x'', 'f'), (x'00', 'g'), (x'0001', 'h'), (x'0002', 'i'), (x'01', 'j'), ('a' || char(0) || 'b', 'l'),"
+        " ('a', 'm'), ('A', 'n'), ('caf' || char(233), 'o'), ('cafe', 'p');");
+
+    CheckSort(db, "words", {{0, false}});
+    CheckSort(db, "words", {{0, true}});
+    CheckSort(db, "words", {{1, false}, {0, true}});
+
+    // blobs by their bytes, and a shorter one first when it's a prefix
+    ResultSet blobs;
+    blobs.Prepare(db, "select a from words where typeof(a) = 'blob'");
+    blobs.Fetch(100, 1000);
+    blobs.Sort({{0, false}});
+    CHECK(blobs.Rows() == 5);
+    if (blobs.Rows() == 5) {
+        CHECK(blobs.GetBytes(0, 0) == 0);
+        CHECK(blobs.GetBytes(1, 0) == 1 && blobs.GetText(1, 0)[0] == 0);
+        CHECK(blobs.GetBytes(2, 0) == 2 && blobs.GetText(2, 0)[1] == 1);
+        CHECK(blobs.GetBytes(3, 0) == 2 && blobs.GetText(3, 0)[1] == 2);
+        CHECK(blobs.GetBytes(4, 0) == 1 && blobs.GetText(4, 0)[0] == 1);
+    }
+
+    // and enough rows that the sort is split across threads
+    Exec(db, "create table big(a, b, c);");
+    Exec(db, "begin");
+    sqlite3_stmt *insert = NULL;
+    sqlite3_prepare_v2(db, "insert into big values (?, ?, ?)", -1, &insert, NULL);
+    for (int i=0; i<200000; i++) {
+        sqlite3_bind_int(insert, 1, Random(1000));
+        char text[16];
+        snprintf(text, sizeof(text), "%c%d", 'a' + Random(26), Random(100));
+        sqlite3_bind_text(insert, 2, text, -1, SQLITE_TRANSIENT);
+        if (Random(10)) {
+            sqlite3_bind_double(insert, 3, Random(100000) / 7.0);
+        }else{
+            sqlite3_bind_null(insert, 3);
+        }
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    Exec(db, "commit");
+
+    CheckSort(db, "big", {{1, false}, {0, true}, {2, false}});
+    CheckSort(db, "big", {{2, true}});
+
+    // no keys is the order the rows came in
+    ResultSet result;
+    result.Prepare(db, "select rowid from big");
+    while (!result.IsDone()) {
+        result.Fetch(100000, 1000);
+    }
+    result.Sort({{0, true}});
+    CHECK(result.GetInt64(0, 0) == 200000);
+    result.Sort({});
+    CHECK(result.GetInt64(0, 0) == 1 && result.GetInt64(199999, 0) == 200000);
+
+    blobs.Clear();
+    result.Clear();
+    sqlite3_close(db);
+}
+
+static void TestSortTypes()
+{
+    sqlite3 *db = OpenMemory();
+    // no declared types, so every value keeps its own: NULLs, then numbers,
+    // then text, then blobs, with integers and reals compared exactly
+    Exec(db, "create table mixed(a, b);"
+        "insert into mixed values (3, 'b'), (2.5, 'a'), (null, 'c'), ('abc', 'a'), (x'00', 'g'), (-7, 'k'),"
+        " (9223372036854775807, 'n'), (9223372036854775807.0, 'o'), (-9223372036854775808, 'p'),"
+        " (-9223372036854775808.0, 'q'), (9007199254740993, 'r'), (9007199254740992.0, 's'), (2, 'b'), (2.0, 'c'),"
+        " (-1e300, 't'), (1e300, 'u'), ('10', 'v');");
+
+    CheckSort(db, "mixed", {{0, false}});
+    CheckSort(db, "mixed", {{0, true}});
+    CheckSort(db, "mixed", {{1, false}, {0, true}});
+
+    // 2^63-1 is less than 2^63, though they are the same as doubles
+    ResultSet result;
+    result.Prepare(db, "select a from mixed where b in ('n', 'o', 'r', 's')");
+    result.Fetch(100, 1000);
+    result.Sort({{0, true}});
+    CHECK(result.Rows() == 4);
+    if (result.Rows() == 4) {
+        CHECK(result.Type(0, 0) == SQLITE_FLOAT && result.Type(1, 0) == SQLITE_INTEGER);
+        CHECK(result.Type(2, 0) == SQLITE_INTEGER && result.GetInt64(2, 0) == 9007199254740993LL);
+    }
+
+    result.Clear();
+    sqlite3_close(db);
+}
+
+// StatementCache
+
+static void TestStatementCache()
+{
+    sqlite3 *db = OpenMemory();
+    Exec(db, "create table s(a); insert into s values (1);");
+
+    StatementCache cache(db, 4);
+    CHECK(cache.CheckSchema());
+    CHECK(!cache.CheckSchema());
+
+    sqlite3_stmt *stmt = cache.Acquire("select * from s");
+    CHECK(stmt != NULL);
+    CHECK(cache.Misses() == 1 && cache.Hits() == 0);
+    cache.Release(stmt);
+
+    // comments and whitespace don't make it a different statement
+    sqlite3_stmt *again = cache.Acquire("select *\n  from s -- the same\n;");
+    CHECK(again == stmt);
+    CHECK(cache.Misses() == 1 && cache.Hits() == 1);
+
+    // one that's in use isn't handed out twice
+    sqlite3_stmt *other = cache.Acquire("select * from s");
+    CHECK(other != NULL && other != stmt);
+    CHECK(cache.Misses() == 2);
+    cache.Release(other);
+    cache.Release(again);
+
+    CHECK(cache.Acquire("select * from nowhere") == NULL);
+
+    // the least recently used go when it's full
+    const char *queries[] = {"select 1", "select 2", "select 3", "select 4", "select 5"};
+    for (const char *query : queries) {
+        cache.Release(cache.Acquire(query));
+    }
+    CHECK(cache.Size() <= 4);
+    long long misses = cache.Misses();
+    cache.Release(cache.Acquire("select 5"));
+    CHECK(cache.Misses() == misses);
+    cache.Release(cache.Acquire("select 1"));
+    CHECK(cache.Misses() == misses + 1);
+
+    // a script's statements one at a time, each cached on its own
+    const char *tail = NULL;
+    stmt = cache.Acquire("select 1; select 2;", &tail);
+    CHECK(stmt != NULL && tail && !strcmp(tail, " select 2;"));
+    cache.Release(stmt);
+
+    // a schema change starts the cache afresh, and the columns are new
+    ResultSet result;
+    CHECK(result.Prepare(&cache, "select * from s"));
+    result.Fetch(10, 1000);
+    CHECK(result.Columns() == 1);
+    result.Clear();
+
+    Exec(db, "alter table s add column b default 'new'");
+    CHECK(cache.CheckSchema());
+    CHECK(cache.Size() == 0);
+    misses = cache.Misses();
+    CHECK(result.Prepare(&cache, "select * from s"));
+    CHECK(cache.Misses() == misses + 1);
+    result.Fetch(10, 1000);
+    CHECK(result.Columns() == 2 && result.Rows() == 1);
+    if (result.Columns() == 2 && result.Rows() == 1) {
+        CHECK(!strcmp(result.ColumnName(1), "b") && !strcmp(result.GetText(0, 1), "new"));
+    }
+    result.Clear();
+    CHECK(!cache.CheckSchema());
+
+    cache.Clear();
+    CHECK(cache.Size() == 0);
+    sqlite3_close(db);
+}
+
+// QueryPlan
+
+static void TestQueryPlan()
+{
+    sqlite3 *db = OpenMemory();
+    Exec(db, "create table t(a, b)");
+    StatementCache cache(db, 4);
+
+    // the same subquery twice gives two lines with the same text
+    QueryPlan plan;
+    CHECK(plan.Load(&cache, "select (select max(a) from t where b > 1), (select max(a) from t where b > 1) from t"));
+    int repeated = 0;
+    for (const PlanNode& node : plan.nodes) {
+        int same = 0;
+        for (const PlanNode& other : plan.nodes) {
+            same += other.detail == node.detail;
+        }
+        if (same > 1) repeated++;
+    }
+    CHECK(repeated >= 2);
+    CHECK(!plan.roots.empty());
+
+    // loops for every line, in the order of the program, as scan status
+    // gives them: each goes to the next line with its text
+    std::vector<ScanStatus> scans;
+    for (size_t i=0; i<plan.nodes.size(); i++) {
+        ScanStatus scan;
+        scan.detail = plan.nodes[i].detail;
+        scan.loops = 1;
+        scan.rows = (sqlite3_int64)i;
+        scan.estimated_rows = 0;
+        scans.push_back(scan);
+    }
+    plan.Annotate(scans);
+    bool ok = true;
+    int same_detail = 0;
+    for (size_t i=0; i<plan.nodes.size(); i++) {
+        ok = ok && plan.nodes[i].has_scan && plan.nodes[i].rows == (sqlite3_int64)i;
+        same_detail += plan.nodes[i].same_detail;
+    }
+    CHECK(ok);
+    CHECK(same_detail == repeated);
+
+    // a loop with text no line has goes nowhere
+    scans.resize(1);
+    scans[0].detail = "no such line";
+    plan.Annotate(scans);
+    ok = true;
+    for (const PlanNode& node : plan.nodes) {
+        ok = ok && !node.has_scan;
+    }
+    CHECK(ok);
+
+    plan.Clear();
+    cache.Clear();
+    sqlite3_close(db);
+}
+
+// Predicate
+
+// The ids of the rows SQLite finds with this where clause.
+static std::set<sqlite3_int64> SqliteIds(sqlite3 *db, const std::string& where)
+{
+    std::set<sqlite3_int64> ids;
+    sqlite3_stmt *stmt = NULL;
+    std::string sql = "select id from p where (" + where + "\n)";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        Check(false, sqlite3_errmsg(db), __FILE__, __LINE__);
+        return ids;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        ids.insert(sqlite3_column_int64(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return ids;
+}
+
+static std::string RandomLike(const char *column)
+{
+    static const char letters[] = "aAbB1";
+    std::string prefix;
+    for (int i=Random(3); i>0; i--) {
+        prefix += letters[Random(sizeof(letters) - 1)];
+    }
+    return std::string(column) + " like '" + prefix + "%'";
+}
+
+static std::string RandomCompare(const char *column)
+{
+    static const char *ops[] = {"<", "<=", ">", ">=", "="};
+    // and numbers next to 2^53, where not every integer is a double
+    static const char *numbers[] = {"0", "5", "-3", "2.5", "10.0", "1e1", "7",
+        "9007199254740993", "9007199254740992.0", "9007199254740994", "9.007199254740992e15"};
+    return std::string(column) + " " + ops[Random(5)] + " " + numbers[Random(11)];
+}
+
+static std::string RandomTerm()
+{
+    switch (Random(6)) {
+    case 0: return RandomLike("name");
+    case 1: return RandomLike("n");
+    case 2: return RandomCompare("n");
+    case 3: return RandomCompare("r");
+    case 4: return RandomCompare("\"n\"");
+    default: return RandomLike("[name]");
+    }
+}
+
+static void TestPredicate()
+{
+    // parsing
+    std::vector<PredicateTerm> terms = ParsePredicate("name like 'Ab%' and  n >= 3 and (x or y)");
+    CHECK(terms.size() == 3);
+    if (terms.size() == 3) {
+        CHECK(terms[0].kind == PredicateTerm::LikePrefix && terms[0].column == "name" && terms[0].prefix == "Ab");
+        CHECK(terms[1].kind == PredicateTerm::Compare && terms[1].op == PredicateTerm::GreaterEqual);
+        CHECK(terms[1].is_integer && terms[1].integer == 3);
+        CHECK(terms[2].kind == PredicateTerm::Other);
+    }
+    CHECK(ParsePredicate("").empty());
+    CHECK(ParsePredicate("name like 'a_%'")[0].kind == PredicateTerm::Other);
+
+    CHECK(PredicateNarrows(ParsePredicate("name like 'abc%'"), ParsePredicate("name like 'ab%'")));
+    CHECK(!PredicateNarrows(ParsePredicate("name like 'ab%'"), ParsePredicate("name like 'abc%'")));
+    CHECK(PredicateNarrows(ParsePredicate("n > 5 and x"), ParsePredicate("x")));
+    CHECK(PredicateNarrows(ParsePredicate("n > 5"), ParsePredicate("n >= 5")));
+    CHECK(!PredicateNarrows(ParsePredicate("n >= 5"), ParsePredicate("n > 5")));
+    CHECK(!PredicateNarrows(ParsePredicate("n < 5"), ParsePredicate("m < 5")));
+    CHECK(PredicateNarrows(ParsePredicate("n like 'a%'"), ParsePredicate("")));
+    // 2^53+1 is more than 2^53, though not as a double
+    CHECK(PredicateNarrows(ParsePredicate("n > 9007199254740993"), ParsePredicate("n > 9007199254740992.0")));
+    CHECK(!PredicateNarrows(ParsePredicate("n > 9007199254740992.0"), ParsePredicate("n > 9007199254740993")));
+
+    // and against SQLite: whenever we claim a filter narrows another, and
+    // work out which rows it keeps, they must be the rows SQLite finds
+    sqlite3 *db = OpenMemory();
+    Exec(db, "create table p(id integer primary key, name text, n integer, r real)");
+    sqlite3_stmt *insert = NULL;
+    sqlite3_prepare_v2(db, "insert into p(name, n, r) values (?, ?, ?)", -1, &insert, NULL);
+    static const char *names[] = {"apple", "Apple", "ABBA", "abc", "b", "B1", "1a", "", "bA"};
+    for (int i=0; i<400; i++) {
+        if (Random(8)) {
+            sqlite3_bind_text(insert, 1, names[Random(9)], -1, SQLITE_STATIC);
+        }else{
+            sqlite3_bind_null(insert, 1);
+        }
+        switch (Random(6)) {
+        case 0: sqlite3_bind_null(insert, 2); break;
+        case 1: sqlite3_bind_text(insert, 2, "abc", -1, SQLITE_STATIC); break;
+        case 2: sqlite3_bind_double(insert, 2, Random(200) / 10.0 - 5); break;
+        case 3: sqlite3_bind_int64(insert, 2, 9007199254740991LL + Random(5)); break;
+        default: sqlite3_bind_int(insert, 2, Random(20) - 5); break;
+        }
+        switch (Random(6)) {
+        case 0: sqlite3_bind_null(insert, 3); break;
+        case 1: sqlite3_bind_double(insert, 3, 9007199254740990.0 + 2 * Random(3)); break;
+        default: sqlite3_bind_double(insert, 3, Random(300) / 20.0 - 5); break;
+        }
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+
+    int evaluated = 0;
+    for (int i=0; i<2000; i++) {
+        std::string wide = Random(3) ? RandomTerm() : "";
+        std::string narrow = wide.empty() ? RandomTerm() : wide + " and " + RandomTerm();
+        if (Random(2)) narrow += " and " + RandomTerm();
+
+        std::vector<PredicateTerm> wide_terms = ParsePredicate(wide);
+        std::vector<PredicateTerm> narrow_terms = ParsePredicate(narrow);
+        if (!PredicateNarrows(narrow_terms, wide_terms)) continue;
+
+        std::set<sqlite3_int64> wide_ids = SqliteIds(db, wide.empty() ? "1=1" : wide);
+        std::set<sqlite3_int64> narrow_ids = SqliteIds(db, narrow);
+        bool subset = true;
+        for (sqlite3_int64 id : narrow_ids) {
+            subset = subset && wide_ids.count(id);
+        }
+        if (!Check(subset, narrow.c_str(), __FILE__, __LINE__)) continue;
+
+        ResultSet rows;
+        rows.Prepare(db, ("select * from p where (" + (wide.empty() ? std::string("1=1") : wide) + "\n)").c_str());
+        while (!rows.IsDone()) {
+            rows.Fetch(1000, 1000);
+        }
+        std::vector<unsigned char> keep;
+        if (!EvaluatePredicate(narrow_terms, wide_terms, rows, &keep)) continue;
+        evaluated++;
+
+        std::set<sqlite3_int64> kept;
+        for (int row=0; row<rows.Rows(); row++) {
+            if (keep[row]) kept.insert(rows.GetInt64(row, 0));
+        }
+        Check(kept == narrow_ids, narrow.c_str(), __FILE__, __LINE__);
+        rows.Clear();
+    }
+    // make sure the comparison above isn't vacuous
+    CHECK(evaluated > 100);
+
+    sqlite3_close(db);
+}
+
+// SchemaCatalog
+
+static void TestSchemaCatalog()
+{
+    sqlite3 *db = OpenMemory();
+    Exec(db, "create table Parent(id integer primary key, name text not null default 'x');"
+        "create table child(id, parent_id references parent(id) on delete cascade);"
+        "create unique index child_parent on child(parent_id);");
+    StatementCache cache(db, 16);
+    SchemaCatalog catalog;
+
+    CHECK(catalog.Update(&cache));
+    CHECK(catalog.Error().empty());
+    CHECK(catalog.Tables().size() == 2);
+    CHECK(!catalog.Update(&cache));
+
+    // names are found ignoring case, as SQLite does
+    const CatalogTable *parent = catalog.Find("parent");
+    CHECK(parent && parent->name == "Parent");
+    if (parent && parent->columns.size() == 2) {
+        CHECK(parent->columns[0].primary_key == 1);
+        CHECK(parent->columns[1].not_null && parent->columns[1].default_value == "'x'");
+    }
+    const CatalogTable *child = catalog.Find("CHILD");
+    CHECK(child && child->indexes.size() == 1 && child->foreign_keys.size() == 1);
+    if (child && child->foreign_keys.size() == 1) {
+        CHECK(child->foreign_keys[0].table == "parent" && child->foreign_keys[0].on_delete == "CASCADE");
+    }
+    CHECK(catalog.Find("nowhere") == NULL);
+
+    // read again only once the schema changes
+    int version = catalog.Version();
+    Exec(db, "create table later(x)");
+    cache.CheckSchema();
+    CHECK(catalog.Update(&cache));
+    CHECK(catalog.Version() != version && catalog.Find("later") != NULL);
+
+    catalog.Clear();
+    cache.Clear();
+    sqlite3_close(db);
+}
+
+// Exporter and Importer
+
+static void WaitFor(Exporter *exporter)
+{
+    while (exporter->IsBusy()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    exporter->Stop();
+}
+
+static std::string ReadFile(const char *path)
+{
+    std::string text;
+    FILE *file = fopen(path, "rb");
+    if (!file) return text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(file);
+    return text;
+}
+
+// Export a query, and return what was written.
+static std::string Export(ConnectionPool *pool, const char *sql, ExportFormat format)
+{
+    const char *path = "sql-gui-tests.export";
+    Exporter exporter;
+    CHECK(exporter.Start(pool, sql, path, format, "copy"));
+    WaitFor(&exporter);
+    CHECK(exporter.Error().empty() && !exporter.WasCancelled());
+    std::string text = ReadFile(path);
+    CHECK(exporter.Bytes() == (long long)text.size());
+    remove(path);
+    return text;
+}
+
+static void TestExport()
+{
+    ConnectionPool pool;
+    OpenOptions options;
+    if (!CHECK(pool.Open("", options))) return;
+
+    sqlite3 *db = pool.LockWriter(10);
+    Exec(db, "create table awkward(a, b);"
+        "insert into awkward values"
+        " (1, 'plain'),"
+        " (-2.5, 'comma, \"quote\"'),"
+        " (1.0, 'line' || char(10) || 'tab' || char(9) || 'back\\slash'),"
+        " (null, ''),"
+        " (0.1, x'00ff'),"
+        " (1e300, null);");
+    pool.UnlockWriter();
+
+    // Each format's quoting of commas, quotes, line breaks, tabs,
+    // backslashes, NULL against '', reals that look like integers and blobs.
+    const char *sql = "select * from awkward";
+    static const char csv[] =
+        "a,b\r\n"
+        "1,plain\r\n"
+        "-2.5,\"comma, \"\"quote\"\"\"\r\n"
+        "1.0,\"line\ntab\tback\\slash\"\r\n"
+        ",\"\"\r\n"
+        "0.1,\0\xff\r\n"
+        "1.0e+300,\r\n";
+    static const char tsv[] =
+        "a\tb\n"
+        "1\tplain\n"
+        "-2.5\tcomma, \"quote\"\n"
+        "1.0\tline\\ntab\\tback\\\\slash\n"
+        "\\N\t\n"
+        "0.1\t\0\xff\n"
+        "1.0e+300\t\\N\n";
+    static const char json[] =
+        "[\n"
+        "{\"a\":1,\"b\":\"plain\"},\n"
+        "{\"a\":-2.5,\"b\":\"comma, \\\"quote\\\"\"},\n"
+        "{\"a\":1.0,\"b\":\"line\\ntab\\tback\\\\slash\"},\n"
+        "{\"a\":null,\"b\":\"\"},\n"
+        "{\"a\":0.1,\"b\":\"00ff\"},\n"
+        "{\"a\":1.0e+300,\"b\":null}\n"
+        "]\n";
+    CHECK(Export(&pool, sql, ExportFormat_CSV) == std::string(csv, sizeof(csv) - 1));
+    CHECK(Export(&pool, sql, ExportFormat_TSV) == std::string(tsv, sizeof(tsv) - 1));
+    CHECK(Export(&pool, sql, ExportFormat_JSON) == json);
+
+    // The SQL script recreates the rows exactly, types included.
+    std::string script = Export(&pool, sql, ExportFormat_SQL);
+    db = pool.LockWriter(10);
+    Exec(db, "create table copy(a, b);");
+    Exec(db, script.c_str());
+    const char *diff =
+        "select count(*) from (select a, typeof(a), b, typeof(b) from awkward"
+        " except select a, typeof(a), b, typeof(b) from copy)";
+    CHECK(QueryInt(db, "select count(*) from copy") == 6);
+    CHECK(QueryInt(db, diff) == 0);
+    pool.UnlockWriter();
+
+    // No rows still writes the header.
+    CHECK(Export(&pool, "select * from awkward where 0", ExportFormat_CSV) == "a,b\r\n");
+}
+
+static void WaitFor(Importer *importer)
+{
+    while (importer->IsBusy()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    importer->Stop();
+}
+
+static void TestRoundTrip(ConnectionPool *pool, ExportFormat export_format, ImportFormat import_format,
+    const char *path, const char *table)
+{
+    Exporter exporter;
+    CHECK(exporter.Start(pool, "select * from source", path, export_format, ""));
+    WaitFor(&exporter);
+    CHECK(exporter.Error().empty());
+    CHECK(!exporter.WasCancelled());
+
+    ImportOptions options;
+    options.format = import_format;
+    options.threads = 3;
+    Importer importer;
+    CHECK(importer.Start(pool, path, table, options));
+    WaitFor(&importer);
+    CHECK(importer.Error().empty());
+    CHECK(!importer.WasCancelled());
+    CHECK(importer.Rows() == exporter.Rows());
+    CHECK(importer.Bytes() == importer.FileSize());
+
+    // every value, and its type, came back as it went out
+    sqlite3 *db = pool->LockWriter(10);
+    CHECK(db != NULL);
+    if (!db) return;
+    std::string columns = "id, typeof(id), name, typeof(name), n, typeof(n), r, typeof(r)";
+    std::string from_source = "select " + columns + " from source";
+    std::string from_table = "select " + columns + " from " + QuoteIdentifier(table);
+    CHECK(QueryInt(db, std::string("select count(*) from ") + QuoteIdentifier(table)) ==
+        QueryInt(db, "select count(*) from source"));
+    CHECK(QueryInt(db, "select count(*) from (" + from_source + " except " + from_table + ")") == 0);
+    CHECK(QueryInt(db, "select count(*) from (" + from_table + " except " + from_source + ")") == 0);
+    pool->UnlockWriter();
+
+    remove(path);
+}
+
+static void TestExportImport()
+{
+    const char *path = "sql-gui-tests.db";
+    remove(path);
+
+    ConnectionPool pool;
+    OpenOptions options;
+    if (!CHECK(pool.Open(path, options))) {
+        fprintf(stderr, "%s\n", pool.Error().c_str());
+        return;
+    }
+
+    // the awkward values, and enough rows to be cut into several pieces
+    sqlite3 *db = pool.LockWriter(10);
+    Exec(db, "create table source(id, name, n, r);"
+        "insert into source values"
+        " (1, 'plain', 1, 0.1),"
+        " (2, 'comma, and \"quotes\"', -42, -2.5),"
+        " (3, 'two' || char(10) || 'lines' || char(13) || char(10) || 'and a tab' || char(9) || '.', 0, 1.0),"
+        " (4, '', null, null),"
+        " (5, null, 123456789012345678, 1e300),"
+        " (6, 'back\\slash and \\N', -123456789012345678, 1.0/3),"
+        " (7, '007', 7, -0.0001),"
+        " (8, 'caf' || char(233) || ' ' || char(0x4e2d), 8, 123456.789),"
+        " (9, '\"', 9, 2.2250738585072014e-308),"
+        " (10, ' leading and trailing ', 10, 0.30000000000000004);"
+        "with recursive i(x) as (select 11 union all select x+1 from i where x < 300000)"
+        " insert into source select x, 'row ' || x || ', with \"' || (x % 7) || '\"', x * 3 - 100000,"
+        " case x % 5 when 0 then null else x / 8.0 end from i;");
+    pool.UnlockWriter();
+
+    TestRoundTrip(&pool, ExportFormat_CSV, ImportFormat_CSV, "sql-gui-tests.csv", "from csv");
+    TestRoundTrip(&pool, ExportFormat_TSV, ImportFormat_TSV, "sql-gui-tests.tsv", "from tsv");
+
+    pool.Close();
+    remove(path);
+    remove("sql-gui-tests.db-wal");
+    remove("sql-gui-tests.db-shm");
+}
+
+int main()
+{
+    TestOpenDatabase();
+    TestOpenOptions();
+    TestStreaming();
+    TestMoveRowsTo();
+    TestScriptCancel();
+    TestStringArena();
+    TestSort();
+    TestSortTypes();
+    TestStatementCache();
+    TestSchemaCatalog();
+    TestQueryPlan();
+    TestPredicate();
+    TestExport();
+    TestExportImport();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}